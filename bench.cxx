@@ -0,0 +1,235 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "cpparse.hxx"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Hardware counters read around each workload. Wall clock numbers for parses
+// this short drift with whatever else the host runs, while these stay put.
+// Counters the kernel or hardware won't give us are left out of the report.
+class Counters {
+ public:
+  static const int count = 5;
+  const char* const names[count] = {"instructions", "cycles", "branch-misses",
+                                    "L1d-misses", "LLC-misses"};
+  long long values[count];
+
+  Counters() : fds() {
+#ifdef __linux__
+    const unsigned long long cache_miss =
+        PERF_COUNT_HW_CACHE_OP_READ << 8 |
+        PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    const pair<unsigned, unsigned long long> events[count] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cache_miss},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cache_miss}};
+    for (int i = 0; i < count; i++) {
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = events[i].first;
+      attr.config = events[i].second;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;  // Allowed without privileges
+      attr.exclude_hv = 1;
+      fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#else
+    for (int i = 0; i < count; i++) {
+      fds[i] = -1;
+    }
+#endif
+  }
+
+  ~Counters() {
+#ifdef __linux__
+    for (int fd : fds) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+#endif
+  }
+
+  bool available(int i) const { return fds[i] >= 0; }
+
+  void start() {
+#ifdef __linux__
+    for (int fd : fds) {
+      if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+  }
+
+  void stop() {
+#ifdef __linux__
+    for (int i = 0; i < count; i++) {
+      values[i] = 0;
+      if (fds[i] >= 0) {
+        ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fds[i], &values[i], sizeof(values[i])) != sizeof(values[i])) {
+          values[i] = 0;
+        }
+      }
+    }
+#endif
+  }
+
+ private:
+  long fds[count];
+};
+
+// Run `work` `iterations` times, and report time and counters per iteration
+// and per token
+void measure(Counters& counters, const char* name, int iterations,
+             int tokens, const function<void()>& work) {
+  work();  // Warm up caches and the allocator
+  counters.start();
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    work();
+  }
+  auto end = chrono::steady_clock::now();
+  counters.stop();
+
+  double nanos = chrono::duration<double, nano>(end - start).count();
+  printf("%-12s %12.1f ns/iter %10.2f ns/token\n", name, nanos / iterations,
+         nanos / iterations / tokens);
+  for (int i = 0; i < Counters::count; i++) {
+    if (counters.available(i)) {
+      double per_iteration = double(counters.values[i]) / iterations;
+      printf("  %-14s %12.1f /iter %10.2f /token\n", counters.names[i],
+             per_iteration, per_iteration / tokens);
+    }
+  }
+}
+
+// The options every workload uses, a few of each kind
+template <typename Parser>
+void add_options(Parser& parser, int options) {
+  for (int i = 0; i < options; i++) {
+    string name = "option-" + to_string(i);
+    switch (i % 3) {
+      case 0:
+        parser.add_flag(name, true).help("A flag");
+        break;
+      case 1:
+        parser.template add_optargument<int>(name, 0).help("A number");
+        break;
+      case 2:
+        parser.template add_optargument<string>(name, "").help("Some text");
+        break;
+    }
+  }
+  parser.template add_argument<string>("input").help("The input");
+}
+
+// Parse every command line of a capture corpus through `parser`, see
+// Parser::capture. This should be a parser with the options of the tool that
+// captured it, and keep its errors rather than exit, since a corpus from
+// another version of the tool can have options this one doesn't. Rejected
+// lines are still timed, but are reported so that a corpus that doesn't
+// match the parser is obvious.
+template <typename Parser>
+void replay(Counters& counters, const char* path, int iterations,
+            Parser& parser) {
+  auto corpus = cpparse::read_corpus(path);
+  vector<vector<char*>> lines;
+  int tokens = 0;
+  for (auto& line : corpus) {
+    lines.emplace_back();
+    for (auto& token : line) {
+      lines.back().push_back(&token[0]);
+    }
+    tokens += static_cast<int>(line.size());
+  }
+  if (lines.empty()) {
+    printf("Corpus \"%s\" is empty\n", path);
+    return;
+  }
+
+  int accepted = 0;
+  for (auto& line : lines) {
+    accepted += parser.parse(static_cast<int>(line.size()), line.data());
+  }
+  printf("Replaying %zu command lines, %d tokens: %d accepted, %zu rejected\n",
+         lines.size(), tokens, accepted, lines.size() - accepted);
+  measure(counters, "replay", iterations, tokens, [&]() {
+    for (auto& line : lines) {
+      parser.parse(static_cast<int>(line.size()), line.data());
+    }
+  });
+}
+
+int main(int argc, char** argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+  const char* corpus = argc > 2 ? argv[2] : nullptr;
+  const int options = 30;
+
+  // A command line using every option once, plus the positional argument
+  vector<string> tokens = {"bench"};
+  for (int i = 0; i < options; i++) {
+    tokens.push_back("--option-" + to_string(i));
+    if (i % 3 == 1) {
+      tokens.push_back(to_string(i));
+    } else if (i % 3 == 2) {
+      tokens.push_back("text");
+    }
+  }
+  tokens.push_back("input.txt");
+  vector<char*> args;
+  for (auto& token : tokens) {
+    args.push_back(&token[0]);
+  }
+  int count = static_cast<int>(args.size());
+
+  Counters counters;
+  bool any = false;
+  for (int i = 0; i < Counters::count; i++) {
+    any |= counters.available(i);
+  }
+  if (!any) {
+    printf("Hardware counters unavailable, reporting wall clock only\n");
+  }
+
+  measure(counters, "register", iterations, options, [&]() {
+    cpparse::Parser parser("Benchmark");
+    add_options(parser, options);
+  });
+
+  cpparse::Parser parser("Benchmark");
+  add_options(parser, options);
+  measure(counters, "parse", iterations, count - 1,
+          [&]() { parser.parse(count, args.data()); });
+
+  ostringstream out;
+  measure(counters, "help", iterations, options, [&]() {
+    out.str("");
+    out << parser.help();
+  });
+
+  if (corpus) {
+    // A tool replaying its own traffic would register its own options here
+    cpparse::BasicParser<cpparse::ReturnErrors> replayer("Benchmark");
+    add_options(replayer, options);
+    replay(counters, corpus, iterations, replayer);
+  }
+}
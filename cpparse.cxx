@@ -1,605 +1,2497 @@
-#include <memory>
-#include <map>
-#include <vector>
-#include <string>
+#ifndef CPPARSE_CXX
+#define CPPARSE_CXX
+
+#include "cpparse.hxx"
+#include "cpparse_parser.hxx"
 
-#include <stdexcept>
-#include <typeinfo>
 #include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
 #include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
 #include <sstream>
-#include <cstdlib>
-
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#ifdef __unix__
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <limits.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#ifdef CPPARSE_LIBRARY
+#include "indent.hxx"
+#else
 #include "indent_header.hxx"
+#endif
 
 namespace cpparse {
+// ------
+// Errors
+// ------
+#ifdef CPPARSE_NO_EXCEPTIONS
+CPPARSE_INLINE void abort_handler(const char* message) {
+  std::cerr << message << std::endl;
+  std::abort();
+}
+
+CPPARSE_INLINE ErrorHandler& error_handler() {
+  static ErrorHandler handler = abort_handler;
+  return handler;
+}
+
+CPPARSE_INLINE void set_error_handler(ErrorHandler handler) {
+  error_handler() = handler;
+}
+#endif
+
+CPPARSE_INLINE SignatureType::SignatureType(const char* signature) : text() {
+  const char* start = std::strstr(signature, "T = ");
+  if (!start) {
+    std::strcpy(text, "value");
+    return;
+  }
+  start += 4;
+  std::size_t length = std::min(std::strcspn(start, ";]"), sizeof(text) - 1);
+  std::memcpy(text, start, length);
+}
+
+// -----------------
+// Option Namespaces
+// -----------------
+CPPARSE_INLINE OptionTrie::OptionTrie() : nodes(1, Node{{}, nullptr}) {}
+
+CPPARSE_INLINE bool OptionTrie::insert(const std::string& path,
+                                       Option* option) {
+  if (path.empty() || path.front() == '.' || path.back() == '.' ||
+      path.find("..") != std::string::npos) {
+    return false;
+  }
+
+  std::size_t node = 0;
+  std::size_t begin = 0;
+  while (begin <= path.size()) {
+    std::size_t end = std::min(path.find('.', begin), path.size());
+    std::string segment = path.substr(begin, end - begin);
+    auto& children = nodes[node].children;
+    auto child = std::lower_bound(
+        children.begin(), children.end(), segment,
+        [](const std::pair<std::string, std::size_t>& a,
+           const std::string& b) { return a.first < b; });
+    if (child == children.end() || child->first != segment) {
+      child = children.emplace(child, segment, nodes.size());
+      nodes.push_back(Node{{}, nullptr});
+    }
+    node = child->second;
+    begin = end + 1;
+  }
+  nodes[node].option = option;
+  return true;
+}
+
+// Children are compared with each segment in place, so a lookup never copies
+// the path
+CPPARSE_INLINE Option* OptionTrie::find(const std::string& path) const {
+  std::size_t node = 0;
+  std::size_t begin = 0;
+  while (begin <= path.size()) {
+    std::size_t end = std::min(path.find('.', begin), path.size());
+    std::size_t length = end - begin;
+    const auto& children = nodes[node].children;
+    auto child = std::lower_bound(
+        children.begin(), children.end(), 0,
+        [&](const std::pair<std::string, std::size_t>& a, int) {
+          return path.compare(begin, length, a.first) > 0;
+        });
+    if (child == children.end() ||
+        path.compare(begin, length, child->first) != 0) {
+      return nullptr;
+    }
+    node = child->second;
+    begin = end + 1;
+  }
+  return nodes[node].option;
+}
+
+CPPARSE_INLINE Binder::Binder(const std::function<void(Option*)>& enroll_,
+                              const std::string& name_space)
+    : enroll(enroll_), prefix(name_space + '.') {}
+
+// Length of the namespace of `name`, 0 if it has none
+CPPARSE_INLINE std::size_t namespace_length(const std::string& name) {
+  std::size_t dot = name.rfind('.');
+  return dot == std::string::npos ? 0 : dot;
+}
+
+CPPARSE_INLINE bool namespace_less(const Option* a, const Option* b) {
+  int order = a->name.compare(0, namespace_length(a->name), b->name, 0,
+                              namespace_length(b->name));
+  return order ? order < 0 : a->name < b->name;
+}
+
+// Prints the heading of the namespace of `option`, unless `previous` (null
+// for the first option) was in the same one
+CPPARSE_INLINE void namespace_heading(std::ostream& os, const Option* previous,
+                                      const Option& option) {
+  std::size_t length = namespace_length(option.name);
+  if (previous && length == namespace_length(previous->name) &&
+      !option.name.compare(0, length, previous->name, 0, length)) {
+    return;
+  }
+  if (length) {
+    os << '\n' << option.name.substr(0, length) << " Options:\n";
+  } else {
+    os << "\nOptional Arguments:\n";
+  }
+}
+
+// -----------------
+// Constraint Groups
+// -----------------
+CPPARSE_INLINE ConstraintGroup make_group(Group kind,
+                                          const std::vector<Option*>& members) {
+  if (members.empty()) {
+    fail<std::invalid_argument>("Can't add an empty group of options");
+  }
+  ConstraintGroup group{kind, members, {}};
+  for (auto* option : members) {
+    if (option->id / 64 >= group.mask.size()) {
+      group.mask.resize(option->id / 64 + 1);
+    }
+    if (group.mask[option->id / 64] >> option->id % 64 & 1) {
+      fail<std::invalid_argument>(
+          std::string("Can't add an option to a group twice: \"") +
+          option->name + '"');
+    }
+    group.mask[option->id / 64] |= std::uint64_t(1) << option->id % 64;
+  }
+  return group;
+}
+
+// Only the error path looks at individual members
+CPPARSE_INLINE void check_groups(ArgReader& reader,
+                                 const ConstraintGroup* groups,
+                                 std::size_t count) {
+  for (std::size_t i = 0; i < count && !reader.failed; i++) {
+    const auto& group = groups[i];
+    std::size_t given = 0;
+    std::size_t words = std::min(group.mask.size(), reader.seen.size());
+    for (std::size_t word = 0; word < words; word++) {
+      given += std::bitset<64>(group.mask[word] & reader.seen[word]).count();
+    }
+
+    bool too_many = given > 1 && (group.kind == Group::exclusive ||
+                                  group.kind == Group::exactly_one);
+    bool too_few = given == 0 && (group.kind == Group::exactly_one ||
+                                  group.kind == Group::at_least_one);
+    bool partial = given && given < group.members.size() &&
+                   group.kind == Group::together;
+    bool incomplete =
+        given < group.members.size() && group.kind == Group::required;
+    const Option* first_given = nullptr;
+    const Option* first_missing = nullptr;
+    for (auto* option : group.members) {
+      bool seen = reader.was_seen(option->id);
+      if (too_many && seen && first_given) {
+        reader.report(ParseError{ParseError::Kind::conflicting_options,
+                                 first_given->name, option->name, ""});
+        break;
+      }
+      first_given = seen && !first_given ? option : first_given;
+      first_missing = !seen && !first_missing ? option : first_missing;
+    }
+    if (partial) {
+      reader.report(ParseError{ParseError::Kind::missing_companion,
+                               first_given->name, first_missing->name, ""});
+    } else if (incomplete) {
+      std::string names;
+      for (auto* option : group.members) {
+        if (!reader.was_seen(option->id)) {
+          names += (names.empty() ? "\"" : ", \"") + option->name + '"';
+        }
+      }
+      bool plural = group.members.size() - given > 1;
+      reader.report(ParseError{ParseError::Kind::missing_options, names, "",
+                               plural ? "options" : "option"});
+    } else if (too_few) {
+      std::string names;
+      for (auto* option : group.members) {
+        names += (names.empty() ? "\"" : ", \"") + option->name + '"';
+      }
+      reader.report(ParseError{
+          ParseError::Kind::missing_choice, names, "",
+          group.kind == Group::exactly_one ? "Exactly one" : "At least one"});
+    }
+  }
+}
+
 // ----------------
 // Usage Formatting
 // ----------------
+CPPARSE_INLINE std::ostream& WrappedFormatter::usage(std::ostream& os,
+                                                     const ParserView& view) {
+  unsigned padding = view.program_name.size() + 8;
+  unsigned max_width = 80;
+  os << "usage: " << view.program_name;
+  if (padding + 4 >= max_width) {
+    padding = 24;
+    os << '\n';
+    for (unsigned i = 0; i < padding; i++) {
+      os << ' ';
+    }
+  } else {
+    os << ' ';
+  }
+
+  indent::Indenter out(os, padding, max_width, padding);
+  std::ostringstream stringify;
+
+  for (auto* opt : view.options) {
+    stringify.clear();
+    stringify.str("");
+
+    stringify << (opt->required ? "" : "[");
+    if (opt->short_name) {
+      stringify << option_char << opt->short_name;
+    } else {
+      stringify << option_char << option_char << opt->name;
+    }
+    opt->format_args(stringify);
+    stringify << (opt->required ? "" : "]");
+
+    out << stringify.str();
+  }
+
+  for (auto* arg : view.arguments) {
+    stringify.clear();
+    stringify.str("");
+
+    arg->format_args(stringify);
+
+    out << stringify.str().substr(1);  // Must start with a space
+  }
+  return os << '\n';
+}
+
+// ---------------
+// Help Formatting
+// ---------------
+// The help text of `option`, followed by its pattern if it has one
+CPPARSE_INLINE std::string described(const ParserView& view,
+                                     const Option& option) {
+  std::string text = view.help(option);
+  if (option.token_pattern) {
+    text += text.empty() ? "(matches " : " (matches ";
+    text += option.token_pattern->text() + ')';
+  }
+  return text;
+}
+
+CPPARSE_INLINE std::ostream& WrappedFormatter::help(std::ostream& os,
+                                                    const ParserView& view) {
+  unsigned max_width = 80;
+  unsigned padding = 24;
+  std::istringstream words;
+  std::string word;
+
+  // Usage
+  usage(os, view) << '\n';
+
+  // Description
+  words.str(view.description);
+  words.clear();
+  indent::Indenter desc(os, 0, max_width, 0);
+  while (words >> word) {
+    desc << word;
+  }
+  os << '\n';
+
+  // Positional Arguments
+  if (!view.arguments.empty()) {
+    os << "\nPositional Arguments:\n";
+
+    for (auto* arg : view.arguments) {
+      // Print out name
+      std::ostringstream buffer;
+      buffer << ' ';
+      arg->format_args(buffer);
+      os << buffer.str();
+
+      std::string text = described(view, *arg);
+      if (text.empty()) {
+        // Don't add spaces if no help to render
+        os << '\n';
+        continue;
+      }
+
+      // Align help text
+      unsigned length = buffer.tellp();
+      if (length + 1 <= padding) {
+        for (unsigned i = 0; i < (padding - length); i++) {
+          os << ' ';
+        }
+      } else {
+        os << '\n';
+        for (unsigned i = 0; i < padding; i++) {
+          os << ' ';
+        }
+      }
+
+      // Print out help text
+      indent::Indenter pos(os, padding, max_width, padding);
+      words.str(text);
+      words.clear();
+      while (words >> word) {
+        pos << word;
+      }
+      os << '\n';
+    }
+  }
+
+  // Optional Arguments, a section per namespace
+  if (!view.options.empty()) {
+    const Option* previous = nullptr;
+    for (auto* opt : view.options) {
+      namespace_heading(os, previous, *opt);
+      previous = opt;
+
+      // Print out name
+      std::ostringstream buffer;
+      buffer << "  ";
+      if (opt->short_name) {
+        buffer << option_char << opt->short_name;
+        opt->format_args(buffer);
+        buffer << ", ";
+      }
+      buffer << option_char << option_char << opt->name;
+      opt->format_args(buffer);
+      os << buffer.str();
+
+      std::string text = described(view, *opt);
+      if (text.empty()) {
+        // Don't add spaces is no help to render
+        os << '\n';
+        continue;
+      }
 
-class Parser::UsageFormatter {
-  friend std::ostream& operator<<(std::ostream& os,
-                                  const UsageFormatter& usage) {
-    return usage.format(os);
+      // Align help text
+      unsigned length = buffer.tellp();
+      if (length + 1 <= padding) {
+        for (unsigned i = 0; i < (padding - length); i++) {
+          os << ' ';
+        }
+      } else {
+        os << '\n';
+        for (unsigned i = 0; i < padding; i++) {
+          os << ' ';
+        }
+      }
+
+      // Print out help text
+      indent::Indenter pos(os, padding, max_width, padding);
+      words.str(text);
+      words.clear();
+      while (words >> word) {
+        pos << word;
+      }
+      os << '\n';
+    }
   }
+  return os;
+}
 
-  const Parser& parser;
-  std::ostream& format(std::ostream& os) const {
-    unsigned padding = parser.program_name.size() + 8;
-    unsigned max_width = 80;
-    os << "usage: " << parser.program_name;
-    if (padding + 4 >= max_width) {
-      padding = 24;
+// ----------------
+// Plain Formatting
+// ----------------
+CPPARSE_INLINE std::ostream& PlainFormatter::usage(std::ostream& os,
+                                                   const ParserView& view) {
+  os << "usage: " << view.program_name;
+  for (auto* opt : view.options) {
+    os << (opt->required ? " " : " [");
+    if (opt->short_name) {
+      os << option_char << opt->short_name;
+    } else {
+      os << option_char << option_char << opt->name;
+    }
+    opt->format_args(os) << (opt->required ? "" : "]");
+  }
+  for (auto* arg : view.arguments) {
+    arg->format_args(os);
+  }
+  return os << '\n';
+}
+
+CPPARSE_INLINE std::ostream& PlainFormatter::help(std::ostream& os,
+                                                  const ParserView& view) {
+  usage(os, view) << '\n';
+  if (!view.description.empty()) {
+    os << view.description << '\n';
+  }
+  if (!view.arguments.empty()) {
+    os << "\nPositional Arguments:\n";
+    for (auto* arg : view.arguments) {
+      arg->format_args(os << ' ');
+      std::string text = described(view, *arg);
+      if (!text.empty()) {
+        os << "  " << text;
+      }
+      os << '\n';
+    }
+  }
+  if (!view.options.empty()) {
+    const Option* previous = nullptr;
+    for (auto* opt : view.options) {
+      namespace_heading(os, previous, *opt);
+      previous = opt;
+      os << "  ";
+      if (opt->short_name) {
+        os << option_char << opt->short_name;
+        opt->format_args(os) << ", ";
+      }
+      os << option_char << option_char << opt->name;
+      opt->format_args(os);
+      std::string text = described(view, *opt);
+      if (!text.empty()) {
+        os << "  " << text;
+      }
       os << '\n';
-      for (unsigned i = 0; i < padding; i++) {
-        os << ' ';
+    }
+  }
+  return os;
+}
+
+// ---------------
+// Compressed Help
+// ---------------
+// Entries are joined, each ending with '\0', and compressed as a sequence of
+// tokens. A control byte below 0x80 is followed by that many plus one literal
+// bytes, otherwise it's a match of (control & 0x7f) + 3 bytes copied from a
+// little endian 16 bit offset back in the output. Matches are found with hash
+// chains, which is slow for a compressor but only runs at build time.
+
+static const std::size_t help_min_match = 3;
+static const std::size_t help_max_match = 0x7f + help_min_match;
+static const std::size_t help_max_literals = 0x80;
+static const std::size_t help_window = 0xffff;
+static const std::size_t help_max_probes = 64;
+
+CPPARSE_INLINE std::string compress_help(
+    const std::vector<std::string>& entries) {
+  std::string text;
+  for (const auto& entry : entries) {
+    text += entry;
+    text.push_back('\0');
+  }
+
+  const std::size_t none = std::string::npos;
+  const std::size_t hash_mask = (1 << 14) - 1;
+  std::vector<std::size_t> head(hash_mask + 1, none);
+  std::vector<std::size_t> previous(text.size(), none);
+  auto hash = [&](std::size_t i) {
+    auto byte = [&](std::size_t j) {
+      return static_cast<std::size_t>(static_cast<unsigned char>(text[j]));
+    };
+    return (byte(i) << 8 ^ byte(i + 1) << 4 ^ byte(i + 2)) & hash_mask;
+  };
+  auto insert = [&](std::size_t i) {
+    if (i + help_min_match <= text.size()) {
+      previous[i] = head[hash(i)];
+      head[hash(i)] = i;
+    }
+  };
+
+  std::string blob;
+  std::size_t literals = 0;  // Start of the literals not yet written
+  auto flush = [&](std::size_t end) {
+    while (literals < end) {
+      std::size_t count = std::min(end - literals, help_max_literals);
+      blob.push_back(static_cast<char>(count - 1));
+      blob.append(text, literals, count);
+      literals += count;
+    }
+  };
+
+  std::size_t i = 0;
+  while (i < text.size()) {
+    std::size_t best_length = 0;
+    std::size_t best_offset = 0;
+    if (i + help_min_match <= text.size()) {
+      std::size_t candidate = head[hash(i)];
+      for (std::size_t probes = 0; candidate != none &&
+                                   i - candidate <= help_window &&
+                                   probes < help_max_probes;
+           probes++, candidate = previous[candidate]) {
+        std::size_t length = 0;
+        while (length < help_max_match && i + length < text.size() &&
+               text[candidate + length] == text[i + length]) {
+          length++;
+        }
+        if (length > best_length) {
+          best_length = length;
+          best_offset = i - candidate;
+        }
+      }
+    }
+
+    if (best_length < help_min_match) {
+      insert(i++);
+      continue;
+    }
+    flush(i);
+    blob.push_back(static_cast<char>(0x80 | (best_length - help_min_match)));
+    blob.push_back(static_cast<char>(best_offset & 0xff));
+    blob.push_back(static_cast<char>(best_offset >> 8));
+    for (std::size_t end = i + best_length; i < end; i++) {
+      insert(i);
+    }
+    literals = i;
+  }
+  flush(text.size());
+  return blob;
+}
+
+// A blob that doesn't decode stops at the last whole token
+CPPARSE_INLINE std::vector<std::string> expand_help(const unsigned char* blob,
+                                                    std::size_t size) {
+  std::string text;
+  std::size_t i = 0;
+  while (i < size) {
+    std::size_t control = blob[i++];
+    if (control < 0x80) {
+      std::size_t count = control + 1;
+      if (count > size - i) {
+        break;
       }
+      text.append(reinterpret_cast<const char*>(blob + i), count);
+      i += count;
+      continue;
+    }
+    if (size - i < 2) {
+      break;
+    }
+    std::size_t offset = blob[i] | static_cast<std::size_t>(blob[i + 1]) << 8;
+    i += 2;
+    if (offset == 0 || offset > text.size()) {
+      break;
+    }
+    // Byte by byte, since a match can overlap what it's copying
+    std::size_t from = text.size() - offset;
+    std::size_t length = (control & 0x7f) + help_min_match;
+    for (std::size_t j = 0; j < length; j++) {
+      text.push_back(text[from + j]);
+    }
+  }
+
+  std::vector<std::string> entries;
+  std::size_t begin = 0;
+  for (std::size_t end; (end = text.find('\0', begin)) != std::string::npos;
+       begin = end + 1) {
+    entries.emplace_back(text, begin, end - begin);
+  }
+  return entries;
+}
+
+CPPARSE_INLINE const std::string& ParserView::help(
+    const Option& option) const {
+  return option.help_index < help_entries.size()
+             ? help_entries[option.help_index]
+             : option.help_text;
+}
+
+// ------------
+// Parse Errors
+// ------------
+CPPARSE_INLINE std::ostream& operator<<(std::ostream& os,
+                                        const ParseError& error) {
+  switch (error.kind) {
+    case ParseError::Kind::unknown_option:
+      return os << error.type << " option \"" << error.name
+                << "\" is not a valid option";
+    case ParseError::Kind::extra_argument:
+      return os << "Argument \"" << error.name
+                << "\" specified, but program demands no more arguments";
+    case ParseError::Kind::invalid_argument:
+      return os << "Parse error trying to interpret '" << error.name
+                << "' argument \"" << error.argument << "\" as an '"
+                << error.type << '\'';
+    case ParseError::Kind::missing_argument:
+      return os << '\'' << error.name
+                << "' requires an argument, but none was specified";
+    case ParseError::Kind::conflicting_options:
+      return os << "Options \"" << error.name << "\" and \"" << error.argument
+                << "\" can't be given together";
+    case ParseError::Kind::missing_companion:
+      return os << "Option \"" << error.name << "\" requires option \""
+                << error.argument << '"';
+    case ParseError::Kind::missing_choice:
+      return os << error.type << " of " << error.name << " must be given";
+    case ParseError::Kind::missing_options:
+      return os << "Missing required " << error.type << ' ' << error.name;
+    case ParseError::Kind::mismatched_pattern:
+      return os << '\'' << error.name << "' argument \"" << error.argument
+                << "\" doesn't match the pattern \"" << error.type << '"';
+  }
+  return os;
+}
+
+CPPARSE_INLINE void ExitSink::report(const ParseError& error,
+                                     const UsageFormatter& usage) {
+  std::cerr << error << '\n' << usage << std::flush;
+  exit(1);
+}
+
+CPPARSE_INLINE FirstErrorSink::FirstErrorSink()
+    : failed(false), error{ParseError::Kind::unknown_option, "", "", ""} {}
+
+CPPARSE_INLINE void FirstErrorSink::report(const ParseError& error_,
+                                           const UsageFormatter& usage) {
+  (void)usage;  // The caller can print it if they want
+  if (!failed) {
+    failed = true;
+    error = error_;
+  }
+}
+
+// ----------------
+// Parse Statistics
+// ----------------
+CPPARSE_INLINE ParseStats::ParseStats()
+    : tokens(),
+      lookups(0),
+      conversions(0),
+      allocations(0),
+      tokenize(0),
+      dispatch(0),
+      convert(0),
+      validate(0),
+      format(0),
+      converted(),
+      phase(nullptr),
+      since() {}
+
+CPPARSE_INLINE PhaseTimer::PhaseTimer(ParseStats* stats_,
+                                      ParseStats::Duration ParseStats::*phase)
+    : stats(stats_), previous(nullptr) {
+  if (!stats) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (stats->phase) {
+    stats->*(stats->phase) += now - stats->since;
+  }
+  previous = stats->phase;
+  stats->phase = phase;
+  stats->since = now;
+}
+
+CPPARSE_INLINE PhaseTimer::~PhaseTimer() {
+  if (!stats) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  stats->*(stats->phase) += now - stats->since;
+  stats->phase = previous;
+  stats->since = now;
+}
+
+CPPARSE_INLINE void merge_stats(ParseStats& into, const ParseStats& from) {
+  for (std::size_t i = 0; i < 5; i++) {
+    into.tokens[i] += from.tokens[i];
+  }
+  into.lookups += from.lookups;
+  into.conversions += from.conversions;
+  into.tokenize += from.tokenize;
+  into.dispatch += from.dispatch;
+  into.convert += from.convert;
+  into.validate += from.validate;
+  into.format += from.format;
+  into.converted.insert(into.converted.end(), from.converted.begin(),
+                        from.converted.end());
+}
+
+// Times `count` conversions for `option` on the parsing thread
+class ConversionTimer {
+  PhaseTimer phase;
+  ParseStats* const stats;
+  const std::string& option;
+  const std::chrono::steady_clock::time_point start;
+
+ public:
+  ConversionTimer(ParseStats* stats_, const std::string& option_,
+                  std::size_t count)
+      : phase(stats_, &ParseStats::convert),
+        stats(stats_),
+        option(option_),
+        start(stats_ ? std::chrono::steady_clock::now()
+                     : std::chrono::steady_clock::time_point()) {
+    if (stats) {
+      stats->conversions += count;
+    }
+  }
+
+  ~ConversionTimer() {
+    if (stats) {
+      stats->converted.push_back(ParseStats::Conversion{
+          option, std::chrono::steady_clock::now() - start});
+    }
+  }
+};
+
+// Characters that can't appear raw in a JSON string
+CPPARSE_INLINE void write_json_string(std::ostream& os,
+                                      const std::string& text) {
+  os << '"';
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      os << escaped;
     } else {
-      os << ' ';
+      os << c;
+    }
+  }
+  os << '"';
+}
+
+CPPARSE_INLINE std::ostream& write_trace(std::ostream& os,
+                                         const ParseStats& stats) {
+  using Micros = std::chrono::duration<double, std::micro>;
+  static const char* const token_names[] = {"end", "argument", "short_opt",
+                                            "long_opt", "marker"};
+  const std::pair<const char*, ParseStats::Duration> phases[] = {
+      {"tokenize", stats.tokenize}, {"dispatch", stats.dispatch},
+      {"convert", stats.convert},   {"validate", stats.validate},
+      {"format", stats.format}};
+
+  ParseStats::Duration total(0);
+  for (const auto& phase : phases) {
+    total += phase.second;
+  }
+  os << "{\"traceEvents\":[\n";
+  os << "{\"name\":\"parse\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":0,"
+     << "\"dur\":" << Micros(total).count() << ",\"args\":{";
+  for (int i = 1; i < 5; i++) {
+    os << "\"" << token_names[i] << "\":" << stats.tokens[i] << ',';
+  }
+  os << "\"lookups\":" << stats.lookups
+     << ",\"conversions\":" << stats.conversions
+     << ",\"allocations\":" << stats.allocations << "}}";
+
+  ParseStats::Duration start(0);
+  for (const auto& phase : phases) {
+    os << ",\n{\"name\":\"" << phase.first
+       << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":"
+       << Micros(start).count() << ",\"dur\":" << Micros(phase.second).count()
+       << '}';
+    if (!std::strcmp(phase.first, "convert")) {
+      // Conversions in the order they ran, inside the convert phase
+      ParseStats::Duration offset = start;
+      for (const auto& conversion : stats.converted) {
+        os << ",\n{\"name\":";
+        write_json_string(os, conversion.option);
+        os << ",\"cat\":\"convert\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+           << "\"ts\":" << Micros(offset).count()
+           << ",\"dur\":" << Micros(conversion.time).count() << '}';
+        offset += conversion.time;
+      }
+    }
+    start += phase.second;
+  }
+  return os << "\n]}\n";
+}
+
+// ---------------
+// Argument Reader
+// ---------------
+CPPARSE_INLINE ArgReader::ArgReader(
+    void (*reporter_)(void* parser, const ParseError& error), void* parser_,
+    int argc, char** argv)
+    : args(argv),
+      itr(argv + 1),
+      end(argv + argc),
+      process_options(true),
+      current(),
+      location(current.begin()),
+      pending(),
+      reporter(reporter_),
+      parser(parser_),
+      failed(false),
+      stats(nullptr),
+      captured(),
+      value_offset(0) {}
+
+CPPARSE_INLINE ot ArgReader::next_flag(std::string& buffer) {
+  PhaseTimer timer(stats, &ParseStats::tokenize);
+  if (location != current.begin() && location != current.end()) {
+    // Parse another short argument
+    buffer.clear();
+    buffer.push_back(*location++);
+    return ot::short_opt;
+
+  } else if (location == current.end() && itr == end) {
+    // Nothing else to parse
+    return ot::end;
+
+  } else if (location == current.end()) {
+    // Grab next argument
+    current.assign(*itr++);
+    location = current.begin();
+  }
+  if (process_options && current.size() == 2 && current[0] == option_char &&
+      current[1] == option_char) {
+    // No mare args arg
+    process_options = false;
+    location = current.end();
+    return ot::marker;
+
+  } else if (process_options && current.size() >= 2 &&
+             current[0] == option_char && current[1] != option_char) {
+    // Short arg
+    buffer.clear();
+    location++;
+    buffer.push_back(*location++);
+    return ot::short_opt;
+  }
+  if (process_options && current.size() > 2 && current[0] == option_char &&
+      current[1] == option_char) {
+    // Long option
+    buffer.assign(location + 2, current.end());  // ignore dashes
+    location = current.end();
+    return ot::long_opt;
+  } else {
+    // Argument
+    // keep location at beginning for argument parsing
+    buffer.assign(current);
+    return ot::argument;
+  }
+}
+
+CPPARSE_INLINE bool ArgReader::next_argument(std::string& buffer) {
+  PhaseTimer timer(stats, &ParseStats::tokenize);
+  if (location != current.begin() && location != current.end()) {
+    // The rest of a short option bundle
+    value_offset = location - current.begin();
+    buffer.assign(location, current.end());
+    location = current.end();
+    return true;
+
+  } else if (location == current.end() && itr == end) {
+    // Nothing else to parse
+    return false;
+
+  } else if (location == current.end()) {
+    // Grab next argument
+    current.assign(*itr++);
+    location = current.begin();
+  }
+  if (process_options && current.size() >= 1 && current[0] == option_char) {
+    // Got an option, failed
+    return false;
+
+  } else {
+    value_offset = 0;
+    buffer.assign(current);
+    location = current.end();
+    return true;
+  }
+}
+
+CPPARSE_INLINE void ArgReader::capture(Capture mode) {
+  std::size_t index = itr - 1 - args;
+  if (index < captured.size() && mode > captured[index].mode) {
+    captured[index] = CapturedToken{mode, value_offset};
+  }
+}
+
+CPPARSE_INLINE void ArgReader::report(const ParseError& error) {
+  failed = true;
+  reporter(parser, error);
+}
+
+CPPARSE_INLINE void ArgReader::mark_seen(std::size_t id) {
+  if (id / 64 >= seen.size()) {
+    seen.resize(id / 64 + 1);  // A plugin loaded mid parse
+  }
+  seen[id / 64] |= std::uint64_t(1) << id % 64;
+}
+
+CPPARSE_INLINE bool ArgReader::was_seen(std::size_t id) const {
+  return id / 64 < seen.size() && (seen[id / 64] >> id % 64 & 1);
+}
+
+CPPARSE_INLINE void ArgReader::option_not_found(const char* type,
+                                                const std::string& option) {
+  report(ParseError{ParseError::Kind::unknown_option, option, "", type});
+}
+
+CPPARSE_INLINE void ArgReader::too_many_args(const std::string& argument) {
+  report(ParseError{ParseError::Kind::extra_argument, argument, "", ""});
+}
+
+CPPARSE_INLINE void ArgReader::parse_error(const std::string& name,
+                                           const std::string& argument,
+                                           const char* type) {
+  report(ParseError{ParseError::Kind::invalid_argument, name, argument, type});
+}
+
+CPPARSE_INLINE void ArgReader::required_argument(const std::string& name) {
+  report(ParseError{ParseError::Kind::missing_argument, name, "", ""});
+}
+
+CPPARSE_INLINE void ArgReader::mismatched_pattern(const std::string& name,
+                                                  const std::string& argument,
+                                                  const Pattern& pattern) {
+  report(ParseError{ParseError::Kind::mismatched_pattern, name, argument,
+                    pattern.text().c_str()});
+}
+
+// -----------
+// Help Option
+// -----------
+
+class HelpFlag : Option {
+  friend Option* help_flag(const std::function<void(std::ostream&)>&);
+
+  const std::function<void(std::ostream&)> print_help;
+
+  HelpFlag(const std::function<void(std::ostream&)>& print_help_)
+      : Option("help", 'h'), print_help(print_help_) {
+    this->help_text = "Show this help message and exit";
+  }
+
+  std::ostream& format_args(std::ostream& os) override { return os; }
+
+  void parse(ArgReader& reader) override {
+    (void)reader;
+    print_help(std::cout);
+    std::cout << std::flush;
+    exit(0);
+  }
+
+  ~HelpFlag() override{};
+};
+
+CPPARSE_INLINE Option* help_flag(
+    const std::function<void(std::ostream&)>& print_help) {
+  return new HelpFlag(print_help);
+}
+
+// --------------
+// Version Option
+// --------------
+
+class VersionFlag : Option {
+  friend Option* version_flag(const std::string&);
+
+  const std::string version;
+
+  VersionFlag(const std::string& version_)
+      : Option("version", '\0'), version(version_) {
+    this->help_text = "Show the version and exit";
+  }
+
+  std::ostream& format_args(std::ostream& os) override { return os; }
+
+  void parse(ArgReader& reader) override {
+    (void)reader;
+    std::cout << version << '\n' << std::flush;
+    exit(0);
+  }
+
+  ~VersionFlag() override{};
+};
+
+CPPARSE_INLINE Option* version_flag(const std::string& version) {
+  return new VersionFlag(version);
+}
+
+// -------
+// Prescan
+// -------
+// Only exact tokens are recognized, since without the spec there's no telling
+// which short options take arguments. Compares raw argv so nothing allocates.
+
+CPPARSE_INLINE void prescan(int argc, char** argv, const char* version,
+                            const char* help) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (!std::strcmp(arg, "--")) {
+      return;
+    } else if (help && (!std::strcmp(arg, "-h") ||
+                        !std::strcmp(arg, "--help"))) {
+      std::fputs(help, stdout);
+      std::fflush(stdout);
+      exit(0);
+    } else if (version && !std::strcmp(arg, "--version")) {
+      std::fputs(version, stdout);
+      std::fputc('\n', stdout);
+      std::fflush(stdout);
+      exit(0);
+    }
+  }
+}
+
+// ------------------
+// Descriptor Options
+// ------------------
+// Options defined with CPPARSE_FLAG and CPPARSE_OPTION. The linker gathers all
+// of their descriptors into one array bounded by these symbols, which are weak
+// so that programs without any descriptors still link.
+
+#if defined(__GNUC__) && defined(__ELF__)
+extern "C" const Descriptor __start_cpparse_options[] __attribute__((weak));
+extern "C" const Descriptor __stop_cpparse_options[] __attribute__((weak));
+#endif
+
+class DescriptorOption : Option {
+  friend void descriptor_options(const std::function<void(Option*)>&);
+
+  const Descriptor& descriptor;
+
+  DescriptorOption(const Descriptor& descriptor_)
+      : Option(descriptor_.name, descriptor_.short_name),
+        descriptor(descriptor_) {
+    this->help_text = descriptor.help;
+  }
+
+  std::ostream& format_args(std::ostream& os) override {
+    if (descriptor.takes_argument) {
+      os << " <" << this->name << '>';
+    }
+    return os;
+  }
+
+  void parse(ArgReader& reader) override {
+    std::string buffer;
+    if (!descriptor.takes_argument) {
+      descriptor.assign(descriptor.storage, nullptr);
+    } else if (!reader.next_argument(buffer)) {
+      reader.required_argument(this->name);
+    } else if (!descriptor.assign(descriptor.storage, buffer.c_str())) {
+      reader.parse_error(this->name, buffer, descriptor.type_name);
+    }
+  }
+
+  ~DescriptorOption() override{};
+};
+
+CPPARSE_INLINE bool assign_descriptor_flag(void* storage, const char* input) {
+  (void)input;  // flags take no argument
+  *static_cast<bool*>(storage) = true;
+  return true;
+}
+
+// A linear scan over every descriptor the linker collected
+CPPARSE_INLINE void descriptor_options(
+    const std::function<void(Option*)>& enroll) {
+#if defined(__GNUC__) && defined(__ELF__)
+  for (const Descriptor* descriptor = __start_cpparse_options;
+       descriptor != __stop_cpparse_options; descriptor++) {
+    enroll(new DescriptorOption(*descriptor));
+  }
+#else
+  (void)enroll;
+#endif
+}
+
+// ----------------
+// Parser Functions
+// ----------------
+
+CPPARSE_INLINE void read_manifest(
+    const std::string& manifest,
+    const std::function<void(const std::string& path,
+                             const std::vector<std::string>& names)>& add) {
+  std::ifstream file(manifest);
+  if (!file) {
+    fail<std::runtime_error>("Couldn't open plugin manifest \"" + manifest +
+                             '"');
+  }
+
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream words(line);
+    std::string path;
+    if (!(words >> path) || path[0] == '#') {
+      continue;
+    }
+    std::vector<std::string> names;
+    std::string name;
+    while (words >> name) {
+      names.push_back(name);
+    }
+    add(path, names);
+  }
+}
+
+CPPARSE_INLINE void* open_plugin(const std::string& path, void*& handle) {
+#ifdef __unix__
+  handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (!handle) {
+    fail<std::runtime_error>("Couldn't load plugin \"" + path +
+                             "\": " + dlerror());
+  }
+  void* enroll = dlsym(handle, "cpparse_register");
+  if (!enroll) {
+    fail<std::runtime_error>("Plugin \"" + path +
+                             "\" doesn't export cpparse_register");
+  }
+  return enroll;
+#else
+  (void)handle;
+  fail<std::runtime_error>("Plugins aren't supported on this platform");
+#endif
+}
+
+CPPARSE_INLINE bool read_config(
+    const std::string& path,
+    const std::function<bool(const std::string& name,
+                             const std::string& value)>& set) {
+  std::ifstream file(path);
+  if (!file) {
+    std::cerr << "Couldn't open config file \"" << path << "\"\n";
+    return false;
+  }
+
+  bool success = true;
+  std::string line;
+  while (std::getline(file, line)) {
+    auto begin = line.find_first_not_of(" \t");
+    if (begin == std::string::npos || line[begin] == '#') {
+      continue;
+    }
+    auto split = line.find_first_of("= \t", begin);
+    auto value_begin = line.find_first_not_of("= \t", split);
+    auto value_end = line.find_last_not_of(" \t\r");
+    std::string name = line.substr(begin, split - begin);
+    std::string value;
+    if (value_begin != std::string::npos) {
+      value = line.substr(value_begin, value_end + 1 - value_begin);
+    }
+
+    if (!set(name, value)) {
+      std::cerr << "Couldn't reload option \"" << name << "\" with value \""
+                << value << "\"\n";
+      success = false;
+    }
+  }
+  return success;
+}
+
+// --------------
+// Capture Corpus
+// --------------
+// A corpus starts with "cpc1", followed by one record per command
+// line: the number of tokens, then each token's length and bytes. Numbers are
+// LEB128 varints, so short command lines take few bytes.
+
+static const std::size_t corpus_magic_size = 4;
+
+CPPARSE_INLINE const char* corpus_magic() { return "cpc1"; }
+
+CPPARSE_INLINE void write_varint(std::string& out, std::size_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+CPPARSE_INLINE bool read_varint(std::istream& in, std::size_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int byte = in.get();
+    if (byte == EOF) {
+      return false;
+    }
+    value |= static_cast<std::size_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Replaces each letter and digit of `value` with one of the same kind, leaving
+// punctuation alone so that the token keeps its format. Redacting writes x for
+// letters and 0 for digits, while hashing picks them from an FNV-1a hash of
+// the value, a digit never greater than the one it replaces and only 0 for 0.
+// That way a number keeps its sign, length and range and still parses.
+CPPARSE_INLINE std::string mask_value(const char* value, Capture mode) {
+  std::uint64_t hash = 14695981039346656037ull;
+  std::size_t length = 0;
+  for (; value[length]; length++) {
+    hash = (hash ^ static_cast<unsigned char>(value[length])) *
+           1099511628211ull;
+  }
+  std::string masked(value, length);
+  for (std::size_t i = 0; i < length; i++) {
+    unsigned pick = static_cast<unsigned>(
+        ((hash + i) * 0x9e3779b97f4a7c15ull) >> 32);
+    char& c = masked[i];
+    if (c >= '1' && c <= '9') {
+      c = mode == Capture::hash ? static_cast<char>('1' + pick % (c - '0'))
+                                : '0';
+    } else if (c >= 'a' && c <= 'z') {
+      c = mode == Capture::hash ? static_cast<char>('a' + pick % 26) : 'x';
+    } else if (c >= 'A' && c <= 'Z') {
+      c = mode == Capture::hash ? static_cast<char>('A' + pick % 26) : 'X';
+    }
+  }
+  return masked;
+}
+
+CPPARSE_INLINE void append_corpus(const std::string& path, int argc,
+                                  char** argv,
+                                  const std::vector<CapturedToken>& tokens) {
+  std::string record;
+  write_varint(record, argc);
+  for (int i = 0; i < argc; i++) {
+    std::string token = argv[i];
+    if (i < static_cast<int>(tokens.size()) &&
+        tokens[i].mode != Capture::keep) {
+      // Only the value, not the options bundled in front of it
+      std::size_t offset = std::min(tokens[i].offset, token.size());
+      token.replace(offset, std::string::npos,
+                    mask_value(argv[i] + offset, tokens[i].mode));
+    }
+    write_varint(record, token.size());
+    record += token;
+  }
+
+#ifdef __unix__
+  // One write under a lock, so that records from processes sharing a corpus
+  // don't mix and only the first writes the magic
+  int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return;
+  }
+  struct stat status;
+  if (!flock(fd, LOCK_EX) && !fstat(fd, &status)) {
+    if (status.st_size == 0) {
+      record.insert(0, corpus_magic(), corpus_magic_size);
+    }
+    ssize_t written = write(fd, record.data(), record.size());
+    (void)written;  // Failing to capture is ignored
+  }
+  close(fd);  // Also unlocks
+#else
+  {
+    std::ifstream existing(path, std::ios::binary | std::ios::ate);
+    if (!existing || existing.tellg() == 0) {
+      record.insert(0, corpus_magic(), corpus_magic_size);
+    }
+  }
+  std::ofstream file(path, std::ios::binary | std::ios::app);
+  file.write(record.data(), record.size());
+#endif
+}
+
+CPPARSE_INLINE std::vector<std::vector<std::string>> read_corpus(
+    const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  char magic[corpus_magic_size];
+  if (!file.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, corpus_magic(), sizeof(magic))) {
+    fail<std::runtime_error>("\"" + path + "\" isn't a capture corpus");
+  }
+
+  std::vector<std::vector<std::string>> corpus;
+  std::size_t count;
+  while (read_varint(file, count)) {
+    std::vector<std::string> line(count);
+    for (auto& token : line) {
+      std::size_t length;
+      if (!read_varint(file, length)) {
+        fail<std::runtime_error>("Capture corpus \"" + path + "\" is cut off");
+      }
+      token.resize(length);
+      if (length && !file.read(&token[0], length)) {
+        fail<std::runtime_error>("Capture corpus \"" + path + "\" is cut off");
+      }
+    }
+    corpus.push_back(std::move(line));
+  }
+  return corpus;
+}
+
+// --------
+// Patterns
+// --------
+// A pattern is parsed into a tree, the tree into a Thompson NFA, and the NFA
+// into a DFA by subset construction over classes of bytes that every set in
+// the pattern treats alike, so the table has one column per class rather than
+// per byte.
+
+static const unsigned pattern_max_repeat = 1000;
+static const std::size_t pattern_max_nfa = 10000;
+static const std::size_t pattern_max_dfa = 4096;
+
+class PatternCompiler {
+ public:
+  using Bytes = std::bitset<256>;
+
+  struct Node {
+    enum Kind { set, sequence, choice, repeat } kind;
+    Bytes bytes;                        // For set
+    std::vector<std::size_t> children;  // For sequence, choice and repeat
+    unsigned min, max;                  // For repeat
+    bool unbounded;                     // For repeat, ignoring max
+  };
+
+  struct State {
+    std::vector<std::size_t> empty;  // Epsilon transitions
+    const Bytes* bytes;              // Consumed to reach `next`, if not null
+    std::size_t next;
+  };
+
+  const std::string& source;
+  std::size_t at;
+  std::vector<Node> nodes;
+  std::vector<State> states;
+
+  explicit PatternCompiler(const std::string& source_)
+      : source(source_), at(0) {}
+
+  [[noreturn]] void invalid(const char* why) {
+    fail<std::invalid_argument>("Invalid pattern \"" + source + "\": " + why);
+  }
+
+  std::size_t add(Node node) {
+    nodes.push_back(std::move(node));
+    return nodes.size() - 1;
+  }
+
+  std::size_t add_set(const Bytes& bytes) {
+    return add(Node{Node::set, bytes, {}, 0, 0, false});
+  }
+
+  // Parsing, lowest precedence first
+  std::size_t parse_choice() {
+    Node choice{Node::choice, {}, {parse_sequence()}, 0, 0, false};
+    while (at < source.size() && source[at] == '|') {
+      at++;
+      choice.children.push_back(parse_sequence());
+    }
+    return choice.children.size() == 1 ? choice.children[0] : add(choice);
+  }
+
+  std::size_t parse_sequence() {
+    Node sequence{Node::sequence, {}, {}, 0, 0, false};
+    while (at < source.size() && source[at] != '|' && source[at] != ')') {
+      sequence.children.push_back(parse_repeat());
+    }
+    return sequence.children.size() == 1 ? sequence.children[0]
+                                         : add(sequence);
+  }
+
+  std::size_t parse_repeat() {
+    std::size_t atom = parse_atom();
+    while (at < source.size()) {
+      unsigned min, max;
+      bool unbounded = false;
+      char c = source[at];
+      if (c == '*' || c == '+' || c == '?') {
+        at++;
+        min = c == '+';
+        max = 1;
+        unbounded = c != '?';
+      } else if (c == '{') {
+        at++;
+        min = max = parse_count();
+        if (at < source.size() && source[at] == ',') {
+          at++;
+          unbounded = at < source.size() && source[at] == '}';
+          if (!unbounded) {
+            max = parse_count();
+          }
+        }
+        if (at >= source.size() || source[at++] != '}') {
+          invalid("unterminated {");
+        }
+        if (!unbounded && max < min) {
+          invalid("repeat bounds out of order");
+        }
+      } else {
+        break;
+      }
+      atom = add(Node{Node::repeat, {}, {atom}, min, max, unbounded});
+    }
+    return atom;
+  }
+
+  unsigned parse_count() {
+    unsigned count = 0;
+    std::size_t begin = at;
+    while (at < source.size() && source[at] >= '0' && source[at] <= '9') {
+      count = count * 10 + (source[at++] - '0');
+      if (count > pattern_max_repeat) {
+        invalid("repeat count too large");
+      }
+    }
+    if (at == begin) {
+      invalid("expected a repeat count");
+    }
+    return count;
+  }
+
+  std::size_t parse_atom() {
+    char c = source[at++];
+    switch (c) {
+      case '(': {
+        std::size_t group = parse_choice();
+        if (at >= source.size() || source[at++] != ')') {
+          invalid("unterminated (");
+        }
+        return group;
+      }
+      case '[':
+        return add_set(parse_class());
+      case '.':
+        return add_set(Bytes().set());
+      case '\\':
+        return add_set(parse_escape());
+      case '*':
+      case '+':
+      case '?':
+      case '{':
+        invalid("nothing to repeat");
+      default:
+        return add_set(Bytes().set(static_cast<unsigned char>(c)));
     }
+  }
 
-    indent::Indenter out(os, padding, max_width, padding);
-    std::ostringstream stringify;
-
-    for (const auto& opt : parser.options) {
-      stringify.clear();
-      stringify.str("");
+  // After a backslash
+  Bytes parse_escape() {
+    if (at >= source.size()) {
+      invalid("trailing \\");
+    }
+    char c = source[at++];
+    Bytes bytes;
+    switch (c) {
+      case 'd':
+      case 'D':
+        add_range(bytes, '0', '9');
+        break;
+      case 'w':
+      case 'W':
+        add_range(bytes, 'a', 'z');
+        add_range(bytes, 'A', 'Z');
+        add_range(bytes, '0', '9');
+        bytes.set('_');
+        break;
+      case 's':
+      case 'S':
+        for (char space : std::string(" \t\n\r\f\v")) {
+          bytes.set(static_cast<unsigned char>(space));
+        }
+        break;
+      default:
+        return bytes.set(static_cast<unsigned char>(c));
+    }
+    return c >= 'A' && c <= 'Z' ? ~bytes : bytes;
+  }
 
-      stringify << '[';
-      if (opt.second->short_name) {
-        stringify << option_char << opt.second->short_name;
+  // After an opening bracket. A ] first, or a - first or last, is literal.
+  Bytes parse_class() {
+    bool negate = at < source.size() && source[at] == '^';
+    at += negate;
+    Bytes bytes;
+    std::size_t begin = at;
+    while (at < source.size() && (source[at] != ']' || at == begin)) {
+      Bytes low;
+      if (source[at] == '\\') {
+        at++;
+        low = parse_escape();
       } else {
-        stringify << option_char << option_char << opt.second->name;
+        low.set(static_cast<unsigned char>(source[at++]));
+      }
+      if (at + 1 < source.size() && source[at] == '-' &&
+          source[at + 1] != ']' && low.count() == 1) {
+        unsigned char first = static_cast<unsigned char>(source[at - 1]);
+        unsigned char last = static_cast<unsigned char>(source[at + 1]);
+        if (last < first) {
+          invalid("class range out of order");
+        }
+        add_range(bytes, first, last);
+        at += 2;
+      } else {
+        bytes |= low;
       }
-      opt.second->format_args(stringify);
-      stringify << ']';
-
-      out << stringify.str();
     }
-
-    for (const auto& arg : parser.arguments) {
-      stringify.clear();
-      stringify.str("");
-
-      arg->format_args(stringify);
-
-      out << stringify.str().substr(1);  // Must start with a space
+    if (at++ >= source.size()) {
+      invalid("unterminated [");
     }
-    return os << '\n';
+    return negate ? ~bytes : bytes;
   }
 
- public:
-  UsageFormatter(const Parser& parser_) : parser(parser_) {}
-};
-
-// ---------------
-// Help Formatting
-// ---------------
-class Parser::HelpFormatter {
-  friend std::ostream& operator<<(std::ostream& os, const HelpFormatter& help) {
-    return help.format(os);
+  static void add_range(Bytes& bytes, unsigned char first,
+                        unsigned char last) {
+    for (unsigned c = first; c <= last; c++) {
+      bytes.set(c);
+    }
   }
 
-  const Parser& parser;
-  const UsageFormatter usage;
-  std::ostream& format(std::ostream& os) const {
-    unsigned max_width = 80;
-    unsigned padding = 24;
-    std::istringstream words;
-    std::string word;
-
-    // Usage
-    os << usage << '\n';
-
-    // Description
-    words.str(parser.description);
-    words.clear();
-    indent::Indenter desc(os, 0, max_width, 0);
-    while (words >> word) {
-      desc << word;
+  // Thompson construction, returning the state `node` ends in when entered
+  // from `from`
+  std::size_t new_state() {
+    if (states.size() >= pattern_max_nfa) {
+      invalid("too large");
     }
-    os << '\n';
-
-    // Positional Arguments
-    if (!parser.arguments.empty()) {
-      os << "\nPositional Arguments:\n";
-
-      for (const auto& arg : parser.arguments) {
-        // Print out name
-        std::ostringstream buffer;
-        buffer << ' ';
-        arg->format_args(buffer);
-        os << buffer.str();
-
-        if (arg->help_text.empty()) {
-          // Don't add spaces if no help to render
-          os << '\n';
-          continue;
-        }
+    states.push_back(State{{}, nullptr, 0});
+    return states.size() - 1;
+  }
 
-        // Align help text
-        unsigned length = buffer.tellp();
-        if (length + 1 <= padding) {
-          for (unsigned i = 0; i < (padding - length); i++) {
-            os << ' ';
-          }
-        } else {
-          os << '\n';
-          for (unsigned i = 0; i < padding; i++) {
-            os << ' ';
-          }
+  std::size_t build(std::size_t index, std::size_t from) {
+    const Node& node = nodes[index];
+    switch (node.kind) {
+      case Node::set: {
+        std::size_t end = new_state();
+        std::size_t start = new_state();
+        states[from].empty.push_back(start);
+        states[start].bytes = &node.bytes;
+        states[start].next = end;
+        return end;
+      }
+      case Node::sequence:
+        for (std::size_t child : node.children) {
+          from = build(child, from);
         }
-
-        // Print out help text
-        indent::Indenter pos(os, padding, max_width, padding);
-        words.str(arg->help_text);
-        words.clear();
-        while (words >> word) {
-          pos << word;
+        return from;
+      case Node::choice: {
+        std::size_t end = new_state();
+        for (std::size_t child : node.children) {
+          std::size_t start = new_state();
+          states[from].empty.push_back(start);
+          states[build(child, start)].empty.push_back(end);
         }
-        os << '\n';
+        return end;
       }
+      case Node::repeat:
+        break;
     }
 
-    // Optional Arguments
-    if (!parser.options.empty()) {
-      os << "\nOptional Arguments:\n";
-
-      for (const auto& opt : parser.options) {
-        // Print out name
-        std::ostringstream buffer;
-        buffer << "  ";
-        if (opt.second->short_name) {
-          buffer << option_char << opt.second->short_name;
-          opt.second->format_args(buffer);
-          buffer << ", ";
-        }
-        buffer << option_char << option_char << opt.second->name;
-        opt.second->format_args(buffer);
-        os << buffer.str();
+    std::size_t child = node.children[0];
+    unsigned min = node.min;
+    unsigned max = node.max;
+    for (unsigned i = 0; i < min; i++) {
+      from = build(child, from);
+    }
+    std::size_t end = new_state();
+    if (node.unbounded) {  // Loop back for as many more as there are
+      std::size_t loop = new_state();
+      states[from].empty.push_back(loop);
+      states[build(child, loop)].empty.push_back(loop);
+      states[loop].empty.push_back(end);
+      return end;
+    }
+    for (unsigned i = min; i < max; i++) {
+      states[from].empty.push_back(end);
+      from = build(child, from);
+    }
+    states[from].empty.push_back(end);
+    return end;
+  }
 
-        if (opt.second->help_text.empty()) {
-          // Don't add spaces is no help to render
-          os << '\n';
-          continue;
+  // Adds every state reachable from `set` without consuming a byte
+  std::vector<std::size_t> closure(std::vector<std::size_t> set) const {
+    std::vector<bool> in(states.size());
+    for (std::size_t state : set) {
+      in[state] = true;
+    }
+    for (std::size_t i = 0; i < set.size(); i++) {
+      for (std::size_t next : states[set[i]].empty) {
+        if (!in[next]) {
+          in[next] = true;
+          set.push_back(next);
         }
+      }
+    }
+    std::sort(set.begin(), set.end());
+    return set;
+  }
+};
 
-        // Align help text
-        unsigned length = buffer.tellp();
-        if (length + 1 <= padding) {
-          for (unsigned i = 0; i < (padding - length); i++) {
-            os << ' ';
-          }
-        } else {
-          os << '\n';
-          for (unsigned i = 0; i < padding; i++) {
-            os << ' ';
-          }
-        }
+CPPARSE_INLINE Pattern::Pattern(const std::string& source_)
+    : source(source_), classes(), class_count(1) {
+  PatternCompiler compiler(source);
+  std::size_t root =
+      source.empty()
+          ? compiler.add(PatternCompiler::Node{PatternCompiler::Node::sequence,
+                                               {}, {}, 0, 0, false})
+          : compiler.parse_choice();
+  if (compiler.at < source.size()) {
+    compiler.invalid("unmatched )");
+  }
+  std::size_t start = compiler.new_state();
+  std::size_t final = compiler.build(root, start);
 
-        // Print out help text
-        indent::Indenter pos(os, padding, max_width, padding);
-        words.str(opt.second->help_text);
-        words.clear();
-        while (words >> word) {
-          pos << word;
-        }
-        os << '\n';
+  // Split the bytes into classes no set in the pattern tells apart
+  for (const auto& node : compiler.nodes) {
+    if (node.kind != PatternCompiler::Node::set) {
+      continue;
+    }
+    std::map<std::pair<unsigned char, bool>, unsigned char> split;
+    for (unsigned c = 0; c < 256; c++) {
+      auto key = std::make_pair(classes[c], bool(node.bytes[c]));
+      auto known = split.find(key);
+      if (known == split.end()) {
+        known = split.emplace(key, split.size()).first;
       }
+      classes[c] = known->second;
     }
-    return os;
+    class_count = split.size();
+  }
+  std::vector<unsigned char> member(class_count);  // A byte of each class
+  for (unsigned c = 0; c < 256; c++) {
+    member[classes[c]] = static_cast<unsigned char>(c);
   }
 
- public:
-  HelpFormatter(const Parser& parser_)
-      : parser(parser_), usage(parser_.usage()) {}
-};
-// ---------------
-// Argument Reader
-// ---------------
-// This is a class to make argument parsing a lot easier by abstracting away
-// difference between long and short options as well as handling the -- marker
-// for the end of arguments. This also provides convenience methods for
-// throwing parsing errors.
-
-// Option types for parsing
-// The ArgReader will return these to indicate what type of option was parsed
-enum class ot { end, argument, short_opt, long_opt, marker };
-
-// Actual ArgReader
-struct ArgReader {
-  char** itr;
-  char* const* end;
-  bool process_options;
-  std::string current;
-  std::string::iterator location;  // Current location in `current`
-
-  // To help with error throwing
-  typename Parser::UsageFormatter usage;
-
-  ArgReader(typename Parser::UsageFormatter usage_, int argc, char** argv)
-      : itr(argv + 1),
-        end(argv + argc),
-        process_options(true),
-        current(),
-        location(current.begin()),
-        usage(usage_) {}
-
-  // Grabs the next `flag` from argv. If flag is an empty argument, then
-  // location is reset so that next_argument does the right thing. Returns an
-  // enum indicating the type of flag it grabbed.
-  ot next_flag(std::string& buffer) {
-    if (location != current.begin() && location != current.end()) {
-      // Parse another short argument
-      buffer.clear();
-      buffer.push_back(*location++);
-      return ot::short_opt;
-
-    } else if (location == current.end() && itr == end) {
-      // Nothing else to parse
-      return ot::end;
-
-    } else if (location == current.end()) {
-      // Grab next argument
-      current.assign(*itr++);
-      location = current.begin();
-    }
-    if (process_options && current.size() == 2 && current[0] == option_char &&
-        current[1] == option_char) {
-      // No mare args arg
-      process_options = false;
-      location = current.end();
-      return ot::marker;
-
-    } else if (process_options && current.size() >= 2 &&
-               current[0] == option_char && current[1] != option_char) {
-      // Short arg
-      buffer.clear();
-      location++;
-      buffer.push_back(*location++);
-      return ot::short_opt;
-    }
-    if (process_options && current.size() > 2 && current[0] == option_char &&
-        current[1] == option_char) {
-      // Long option
-      buffer.assign(location + 2, current.end());  // ignore dashes
-      location = current.end();
-      return ot::long_opt;
-    } else {
-      // Argument
-      // keep location at beginning for argument parsing
-      buffer.assign(current);
-      return ot::argument;
+  // Subset construction, with each DFA state a sorted set of NFA states
+  std::map<std::vector<std::size_t>, int> known;
+  std::vector<std::vector<std::size_t>> pending{compiler.closure({start})};
+  known.emplace(pending[0], 0);
+  for (std::size_t index = 0; index < pending.size(); index++) {
+    auto current = pending[index];  // Copied, pending grows below
+    accepting.push_back(std::binary_search(current.begin(), current.end(),
+                                           final));
+    for (std::size_t c = 0; c < class_count; c++) {
+      std::vector<std::size_t> next;
+      for (std::size_t state : current) {
+        const auto& nfa = compiler.states[state];
+        if (nfa.bytes && (*nfa.bytes)[member[c]]) {
+          next.push_back(nfa.next);
+        }
+      }
+      if (next.empty()) {
+        transitions.push_back(-1);
+        continue;
+      }
+      next = compiler.closure(next);
+      auto found = known.find(next);
+      if (found == known.end()) {
+        if (pending.size() >= pattern_max_dfa) {
+          compiler.invalid("too many states");
+        }
+        found = known.emplace(next, static_cast<int>(pending.size())).first;
+        pending.push_back(next);
+      }
+      transitions.push_back(found->second);
     }
   }
+}
 
-  // Get the next argument. Fails if next argument can't be found (due to
-  // having a flag next or being at the end)
-  bool next_argument(std::string& buffer) {
-    if (location != current.begin() && location != current.end()) {
-      buffer.assign(location, current.end());
-      location = current.end();
-      return true;
-
-    } else if (location == current.end() && itr == end) {
-      // Nothing else to parse
+CPPARSE_INLINE bool Pattern::matches(const std::string& input) const {
+  int state = 0;
+  for (char c : input) {
+    state = transitions[state * class_count +
+                        classes[static_cast<unsigned char>(c)]];
+    if (state < 0) {
       return false;
-
-    } else if (location == current.end()) {
-      // Grab next argument
-      current.assign(*itr++);
-      location = current.begin();
     }
-    if (process_options && current.size() >= 1 && current[0] == option_char) {
-      // Got an option, failed
-      return false;
+  }
+  return accepting[state];
+}
 
-    } else {
-      buffer.assign(current);
-      location = current.end();
-      return true;
+CPPARSE_INLINE const std::string& Pattern::text() const { return source; }
+
+// -----------
+// Worker Pool
+// -----------
+// The threads behind every Task and convert_all, started as work arrives up to
+// one per core. The pool is never destroyed, so that workers still waiting at
+// exit don't hold up static destruction.
+class WorkerPool {
+  const std::size_t limit;
+  std::mutex lock;
+  std::condition_variable arrived;
+  std::deque<std::function<void()>> jobs;
+  std::size_t threads;  // Started so far
+  std::size_t idle;     // Waiting for a job
+
+  WorkerPool()
+      : limit(std::max(1u, std::thread::hardware_concurrency())),
+        threads(0),
+        idle(0) {}
+
+  void run() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+      idle++;
+      arrived.wait(guard, [this]() { return !jobs.empty(); });
+      idle--;
+      std::function<void()> job = std::move(jobs.front());
+      jobs.pop_front();
+      guard.unlock();
+      job();
+      guard.lock();
     }
   }
 
-  // Helpful error messages for parsing. These are here so that arguments can
-  // print used e.g. get access to the parser.
-  void print_usage_exit() {
-    std::cerr << usage << std::flush;
-    exit(1);
+ public:
+  static WorkerPool& shared() {
+    static WorkerPool* pool = new WorkerPool();
+    return *pool;
   }
 
-  void option_not_found(const char* type, const std::string& option) {
-    std::cerr << type << " option \"" << option << "\" is not a valid option\n";
-    print_usage_exit();
-  }
+  std::size_t size() const { return limit; }
 
-  void too_many_args(const std::string& argument) {
-    std::cerr << "Argument \"" << argument
-              << "\" specified, but program demands no more arguments\n";
-    print_usage_exit();
+  void submit(std::function<void()> job) {
+    std::lock_guard<std::mutex> guard(lock);
+    jobs.push_back(std::move(job));
+    if (!idle && threads < limit) {
+      threads++;
+      std::thread(&WorkerPool::run, this).detach();
+    } else {
+      arrived.notify_one();
+    }
   }
+};
 
-  template <typename T>
-  void parse_error(const std::string& name, const std::string& argument) {
-    std::cerr << "Parse error trying to interpret '" << name << "' argument \""
-              << argument << "\" as an '" << typeid(T).name() << "'\n";
-    print_usage_exit();
+// ----
+// Task
+// ----
+struct Task::State {
+  enum Stage { queued, running, done };
+
+  std::function<bool()> work;
+  std::function<bool(bool)> finish;  // Null if the result is final
+  std::mutex lock;
+  std::condition_variable finished_work;
+  Stage stage;
+  bool result;
+  std::exception_ptr error;  // What work threw, if anything
+  std::once_flag finished;
+  bool value;  // The finished result
+
+  // Runs the work unless another thread already has
+  void run() {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      if (stage != queued) {
+        return;
+      }
+      stage = running;
+    }
+    bool returned = false;
+    std::exception_ptr thrown;
+#ifdef CPPARSE_NO_EXCEPTIONS
+    returned = work();
+#else
+    try {
+      returned = work();
+    } catch (...) {
+      thrown = std::current_exception();
+    }
+#endif
+    std::lock_guard<std::mutex> guard(lock);
+    result = returned;
+    error = thrown;
+    stage = done;
+    finished_work.notify_all();
   }
 
-  void required_argument(const std::string& name) {
-    std::cerr << '\'' << name
-              << "' requires an argument, but none was specified\n";
-    print_usage_exit();
+  // Runs the work here if no worker has started it, else waits for it
+  void join() {
+    run();
+    std::unique_lock<std::mutex> guard(lock);
+    finished_work.wait(guard, [this]() { return stage == done; });
   }
 };
 
-// -----------
-// Help Option
-// -----------
+CPPARSE_INLINE Task::Task() : state() {}
+
+CPPARSE_INLINE Task::Task(const std::function<bool()>& work)
+    : Task(work, nullptr) {}
+
+CPPARSE_INLINE Task::Task(const std::function<bool()>& work,
+                          const std::function<bool(bool)>& finish) {
+  auto shared = std::make_shared<State>();
+  shared->work = work;
+  shared->finish = finish;
+  shared->stage = State::queued;
+  WorkerPool::shared().submit([shared]() { shared->run(); });
+  // The last copy of the task waits for the work, since it may use things
+  // that only live as long as the task
+  state = std::shared_ptr<State>(shared.get(),
+                                 [shared](State*) { shared->join(); });
+}
 
-class HelpFlag : Option {
-  friend class Parser;
+CPPARSE_INLINE bool Task::valid() const { return state != nullptr; }
 
-  const Parser& parser;  // Need a reference to print help
+CPPARSE_INLINE bool Task::ready() const {
+  std::lock_guard<std::mutex> guard(state->lock);
+  return state->stage == State::done;
+}
 
-  HelpFlag(const Parser& parser_) : Option("help", 'h'), parser(parser_) {
-    this->help_text = "Show this help message and exit";
+CPPARSE_INLINE void Task::wait() const { get(); }
+
+CPPARSE_INLINE bool Task::get() const {
+  State& shared = *state;
+  std::call_once(shared.finished, [&shared]() {
+    shared.join();
+#ifndef CPPARSE_NO_EXCEPTIONS
+    if (shared.error) {
+      std::rethrow_exception(shared.error);
+    }
+#endif
+    shared.value = shared.finish ? shared.finish(shared.result) : shared.result;
+  });
+  return shared.value;
+}
+
+// ------
+// Option
+// ------
+// ABC for all actual options and arguments. Doesn't do anything other than
+// allowing virtual calls and having a minimal interface.
+
+CPPARSE_INLINE Option::Option(const std::string& name_, char short_name_)
+    : name(name_),
+      short_name(short_name_),
+      help_index(std::string::npos),
+      id(0),
+      required(false),
+      capture_mode(Capture::keep) {}
+
+CPPARSE_INLINE Option::~Option() {}
+
+CPPARSE_INLINE std::ostream& Option::format_args(std::ostream& os) {
+  return os;
+}
+
+CPPARSE_INLINE void Option::parse(ArgReader& reader) {
+  (void)reader;  // ignore unused argument
+}
+
+CPPARSE_INLINE void Option::join(ArgReader& reader) {
+  (void)reader;  // ignore unused argument
+}
+
+CPPARSE_INLINE bool Option::reload(const std::string& input) {
+  (void)input;  // ignore unused argument
+  return false;
+}
+
+// --------------------
+// Single Value Options
+// --------------------
+
+CPPARSE_INLINE SingleOption::SingleOption(const std::string& name,
+                                          char short_name,
+                                          const char* type_name_)
+    : Option(name, short_name), type_name(type_name_), deferred(false) {}
+
+CPPARSE_INLINE std::ostream& SingleOption::format_args(std::ostream& os) {
+  // One arg is required so surrounded with <>
+  return os << " <" << this->name << '>';
+}
+
+CPPARSE_INLINE void SingleOption::parse(ArgReader& reader) {
+  std::string buffer;
+  if (!reader.next_argument(buffer)) {
+    reader.required_argument(this->name);
+    return;
+  }
+  reader.capture(capture_mode);
+  if (token_pattern && !token_pattern->matches(buffer)) {
+    reader.mismatched_pattern(this->name, buffer, *token_pattern);
+    return;
+  }
+  if (deferred) {
+    bool queued = std::find(reader.pending.begin(), reader.pending.end(),
+                            this) != reader.pending.end();
+    if (queued) {
+      // Given again, so the earlier conversion has to finish first. Otherwise
+      // both would write the value at once, and the last one wouldn't win.
+      join(reader);
+      if (reader.failed) {
+        return;
+      }
+    }
+    if (reader.stats) {
+      reader.stats->conversions++;
+    }
+    token = buffer;
+    pending = Task([this, buffer]() { return convert(buffer); });
+    if (!queued) {
+      reader.pending.push_back(this);
+    }
+  } else {
+    bool converted;
+    {
+      ConversionTimer timer(reader.stats, this->name, 1);
+      converted = convert(buffer);
+    }
+    if (!converted) {
+      reader.parse_error(this->name, buffer, type_name);
+    }
   }
+}
 
-  std::ostream& format_args(std::ostream& os) override { return os; }
+CPPARSE_INLINE bool SingleOption::convert(const std::string& input) {
+  CPPARSE_PROBE(convert__start, this->name.c_str(), input.size());
+  bool converted = store(input);
+  CPPARSE_PROBE(convert__end, this->name.c_str(), input.size(), converted);
+  return converted;
+}
 
-  void parse(ArgReader& reader) override {
-    (void)reader;
-    std::cout << parser.help() << std::flush;
-    exit(0);
+CPPARSE_INLINE void SingleOption::join(ArgReader& reader) {
+  bool converted;
+  {
+    PhaseTimer timer(reader.stats, &ParseStats::convert);
+    converted = pending.get();
   }
+  if (!converted) {
+    reader.parse_error(this->name, token, type_name);
+  }
+}
 
-  ~HelpFlag() override{};
-};
+// ----------------------
+// Multiple Value Options
+// ----------------------
 
-// ----------------
-// Parser Functions
-// ----------------
+CPPARSE_INLINE MultiOption::MultiOption(const std::string& name,
+                                        const char* type_name_)
+    : Option(name, '\0'), type_name(type_name_) {}
+
+CPPARSE_INLINE std::ostream& MultiOption::format_args(std::ostream& os) {
+  // Any number of args so surrounded with [] and followed by ...
+  return os << " [<" << this->name << ">...]";
+}
 
-Parser::Parser(const std::string& description_, bool enable_help)
-    : description(description_) {
-  if (enable_help) {
-    enroll_option(new HelpFlag(*this));
+CPPARSE_INLINE void MultiOption::parse(ArgReader& reader) {
+  std::string buffer;
+  while (reader.next_argument(buffer)) {
+    reader.capture(capture_mode);
+    tokens.push_back(buffer);
   }
 }
 
-// Parsing function works in tandem with ArgReader
-void Parser::parse(int argc, char** argv) {
-  if (argc > 0 && !program_name.size()) {  // Assign program name
-    program_name = *argv;
+CPPARSE_INLINE void MultiOption::join(ArgReader& reader) {
+  std::vector<std::string> batch;
+  batch.swap(tokens);  // Emptied for the next parse whatever happens
+  if (reader.failed) {
+    return;
   }
+  std::size_t failure;
+  {
+    ConversionTimer timer(reader.stats, this->name, batch.size());
+    failure = store_all(batch);
+  }
+  if (failure < batch.size()) {
+    reader.parse_error(this->name, batch[failure], type_name);
+  }
+}
 
-  ArgReader reader(usage(), argc, argv);
-  auto args = arguments.begin();
-  std::string flag;
-  ot type;
-  while ((type = reader.next_flag(flag)) != ot::end) {
-    switch (type) {
-      case ot::short_opt: {
-        auto option = short_options.find(flag[0]);
-        if (option == short_options.end()) {
-          reader.option_not_found("Short", flag);
-        } else {
-          option->second->parse(reader);
-        }
-        break;
-      }
-      case ot::long_opt: {
-        auto option = options.find(flag);
-        if (option == options.end()) {
-          reader.option_not_found("Long", flag);
-        } else {
-          option->second->parse(reader);
+// -------------------
+// Parallel Conversion
+// -------------------
+
+// An enum rather than static constants so that the templates using them don't
+// refer to anything with internal linkage, which modules forbid
+enum ParallelSizes : std::size_t {
+  // Inputs smaller than this are converted on the calling thread
+  parallel_threshold = 4096,
+  // Number of tokens a worker claims at a time
+  parallel_chunk = 1024
+};
+
+CPPARSE_INLINE std::size_t convert_all(
+    std::size_t size, const std::function<bool(std::size_t)>& convert) {
+  std::atomic<std::size_t> next_chunk(0);
+  std::mutex failure_lock;
+  std::size_t failure = size;
+  std::exception_ptr error;
+
+  auto work = [&]() {
+    std::size_t chunk;
+    while ((chunk = next_chunk++ * parallel_chunk) < size) {
+      std::size_t stop = std::min(chunk + parallel_chunk, size);
+      for (std::size_t i = chunk; i < stop; i++) {
+        bool converted = false;
+        std::exception_ptr thrown;
+#ifdef CPPARSE_NO_EXCEPTIONS
+        converted = convert(i);
+#else
+        try {
+          converted = convert(i);
+        } catch (...) {
+          thrown = std::current_exception();
         }
-        break;
-      }
-      case ot::argument: {
-        if (args == arguments.end()) {
-          reader.too_many_args(flag);
+#endif
+        if (!converted) {
+          // Only the earliest failure matters, so the rest of this chunk can
+          // be skipped
+          std::lock_guard<std::mutex> guard(failure_lock);
+          if (i < failure) {
+            failure = i;
+            error = thrown;
+          }
+          break;
         }
-        (*args)->parse(reader);
-        args++;
-        break;
-      }
-      case ot::marker: {
-        break;
-      }
-      case ot::end: {
-        throw std::logic_error("Should never reach here");
       }
     }
-  }
-  while (args != arguments.end()) {
-    (*args)->parse(reader);
-    args++;
-  }
-}
+  };
 
-// This is the method to add an option agnostic to everything else
-void Parser::enroll_option(Option* option) {
-  if (options.find(option->name) != options.end()) {
-    throw std::invalid_argument(
-        std::string("Can't add two options with the same name: \"") +
-        option->name + '"');
-  }
-  if (option->short_name &&
-      short_options.find(option->short_name) != short_options.end()) {
-    throw std::invalid_argument(
-        std::string("Can't add two options with the same short name: '") +
-        option->short_name + '\'');
+  std::size_t workers = std::min<std::size_t>(
+      WorkerPool::shared().size(), (size + parallel_chunk - 1) / parallel_chunk);
+  if (size < parallel_threshold || workers < 2) {
+    work();
+  } else {
+    // Helpers that no worker got to in time find every chunk claimed
+    std::vector<Task> helpers;
+    for (std::size_t i = 1; i < workers; i++) {
+      helpers.emplace_back([&work]() {
+        work();
+        return true;
+      });
+    }
+    work();
+    for (auto& helper : helpers) {
+      helper.wait();
+    }
   }
-  options[option->name] = std::move(std::unique_ptr<Option>(option));
-  if (option->short_name) {
-    short_options[option->short_name] = option;
+
+#ifndef CPPARSE_NO_EXCEPTIONS
+  if (error) {
+    std::rethrow_exception(error);
   }
+#endif
+  return failure;
 }
 
-// This is the method to add an argument agnostic to everything else
-void Parser::enroll_argument(Option* argument) {
-  arguments.push_back(std::move(std::unique_ptr<Option>(argument)));
+// ----------------
+// Published Values
+// ----------------
+
+struct Snapshots::State {
+  std::atomic<const void*> current;
+  std::mutex update_lock;  // Serializes writers, readers never take it
+  std::shared_ptr<const void> latest;  // Read and written atomically
+};
+
+CPPARSE_INLINE Snapshots::Snapshots(std::shared_ptr<const void> initial)
+    : state(new State{{initial.get()}, {}, std::move(initial)}) {}
+
+CPPARSE_INLINE Snapshots::~Snapshots() {}
+
+CPPARSE_INLINE const void* Snapshots::get() const {
+  return state->current.load(std::memory_order_acquire);
 }
 
-// Get usage formatter
-typename Parser::UsageFormatter Parser::usage() const {
-  return Parser::UsageFormatter(*this);
+CPPARSE_INLINE std::shared_ptr<const void> Snapshots::snapshot() const {
+  return std::atomic_load(&state->latest);
 }
 
-// Get help formatter
-typename Parser::HelpFormatter Parser::help() const {
-  return Parser::HelpFormatter(*this);
+CPPARSE_INLINE void Snapshots::publish(std::shared_ptr<const void> next) {
+  std::lock_guard<std::mutex> guard(state->update_lock);
+  state->current.store(next.get(), std::memory_order_release);
+  // Frees the old value here unless a snapshot still holds it
+  std::atomic_store(&state->latest, std::move(next));
 }
 
-// ------
-// Option
-// ------
-// ABC for all actual options and arguments. Doesn't do anything other than
-// allowing virtual calls and having a minimal interface.
+// ---------------
+// Memoizing Cache
+// ---------------
+struct MemoTable::State {
+  using Order = std::list<std::string>;
+  using Entry = std::pair<std::shared_ptr<const void>, Order::iterator>;
+
+  std::mutex lock;
+  const std::size_t capacity;
+  Order order;  // Most recently used first
+  std::unordered_map<std::string, Entry> entries;
+};
+
+CPPARSE_INLINE MemoTable::MemoTable(std::size_t capacity)
+    : state(new State{{}, capacity, {}, {}}) {}
+
+CPPARSE_INLINE MemoTable::~MemoTable() {}
+
+CPPARSE_INLINE std::shared_ptr<const void> MemoTable::lookup(
+    const std::string& input,
+    const std::function<std::shared_ptr<const void>(const std::string&)>&
+        convert) {
+  auto& entries = state->entries;
+  auto& order = state->order;
+  {
+    std::lock_guard<std::mutex> guard(state->lock);
+    auto entry = entries.find(input);
+    if (entry != entries.end()) {
+      order.splice(order.begin(), order, entry->second.second);
+      return entry->second.first;
+    }
+  }
 
-Option::Option(const std::string& name_, char short_name_)
-    : name(name_), short_name(short_name_) {}
+  // Convert without holding the lock so expensive conversions of different
+  // tokens can overlap
+  auto result = convert(input);
+  if (!result || !state->capacity) {
+    return result;
+  }
 
-Option::~Option() {}
+  std::lock_guard<std::mutex> guard(state->lock);
+  auto entry = entries.find(input);
+  if (entry != entries.end()) {
+    // Someone else converted the same token in the meantime
+    return entry->second.first;
+  }
+  order.push_front(input);
+  entries.emplace(input, State::Entry(result, order.begin()));
+  if (entries.size() > state->capacity) {
+    entries.erase(order.back());
+    order.pop_back();
+  }
+  return result;
+}
 
-std::ostream& Option::format_args(std::ostream& os) { return os; }
+#ifdef __linux__
+// --------------
+// Config Watcher
+// --------------
+struct Watcher::Thread {
+  std::thread thread;
+};
 
-void Option::parse(ArgReader& reader) {
-  (void)reader;  // ignore unused argument
+CPPARSE_INLINE Watcher::Watcher(
+    const std::function<void(const std::string&)>& reload_,
+    const std::string& path_)
+    : reload(reload_),
+      path(path_),
+      inotify(inotify_init1(IN_CLOEXEC)),
+      wake(eventfd(0, EFD_CLOEXEC)),
+      thread(new Thread) {
+  if (inotify < 0 || wake < 0) {
+    if (inotify >= 0) {
+      close(inotify);
+    }
+    if (wake >= 0) {
+      close(wake);
+    }
+    fail<std::runtime_error>("Couldn't start watching \"" + path + '"');
+  }
+  auto slash = path.rfind('/');
+  std::string directory =
+      slash == std::string::npos ? "." : path.substr(0, slash + 1);
+  if (inotify_add_watch(inotify, directory.c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    close(inotify);
+    close(wake);
+    fail<std::runtime_error>("Couldn't watch directory \"" + directory + '"');
+  }
+  thread->thread = std::thread(&Watcher::run, this);
 }
 
-// ----
-// Flag
-// ----
-// An option with no arguments.
-template <typename T>
-Flag<T>& Parser::add_flag(const std::string& name, char short_name, T constant,
-                          T def) {
-  auto* flag = new Flag<T>(name, short_name, constant, def);
-  enroll_option(flag);
-  return *flag;
+CPPARSE_INLINE Watcher::~Watcher() {
+  // Writing only fails if interrupted, or if the counter is already too high
+  // to add to, which wakes the thread just the same. So the thread always
+  // stops, and is done with the descriptors before they're closed.
+  uint64_t stop = 1;
+  while (::write(wake, &stop, sizeof(stop)) < 0 && errno == EINTR) {
+  }
+  thread->thread.join();
+  close(inotify);
+  close(wake);
 }
 
-template <typename T>
-Flag<T>& Parser::add_flag(const std::string& name, T constant, T def) {
-  return Parser::add_flag(name, '\0', constant, def);
+CPPARSE_INLINE void Watcher::run() {
+  auto slash = path.rfind('/');
+  std::string file =
+      slash == std::string::npos ? path : path.substr(slash + 1);
+  alignas(inotify_event) char buffer[sizeof(inotify_event) + NAME_MAX + 1];
+  pollfd fds[] = {{inotify, POLLIN, 0}, {wake, POLLIN, 0}};
+
+  for (;;) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;  // A signal isn't a reason to stop watching
+      }
+      break;
+    }
+    if (fds[1].revents & POLLIN) {
+      break;
+    }
+    ssize_t length = ::read(inotify, buffer, sizeof(buffer));
+    bool changed = false;
+    for (ssize_t i = 0; i < length;) {
+      auto* event = reinterpret_cast<inotify_event*>(buffer + i);
+      changed |= event->len && file == event->name;
+      i += sizeof(inotify_event) + event->len;
+    }
+    if (changed) {
+      reload(path);
+    }
+  }
 }
+#endif
 
-template <typename T>
-Flag<T>::Flag(const std::string& name, char short_name, const T& constant_,
-              const T& def)
-    : Option(name, short_name), value(def), constant(constant_) {}
+// ---------------------
+// Fixed Capacity Parser
+// ---------------------
+// Built on strto* since they read straight from the C string
+
+CPPARSE_INLINE bool read_fixed(const char* input, long long min, long long max,
+                               long long& output) {
+  char* end;
+  errno = 0;
+  output = std::strtoll(input, &end, 0);
+  return end != input && !*end && !errno && output >= min && output <= max;
+}
 
-template <typename T>
-std::ostream& Flag<T>::format_args(std::ostream& os) {
-  return os;
+CPPARSE_INLINE bool read_fixed(const char* input, unsigned long long min,
+                               unsigned long long max,
+                               unsigned long long& output) {
+  char* end;
+  errno = 0;
+  output = std::strtoull(input, &end, 0);
+  // strtoull accepts a sign and negates, which no unsigned value should
+  return end != input && !*end && !errno && !std::strchr(input, '-') &&
+         output >= min && output <= max;
 }
 
-template <typename T>
-void Flag<T>::parse(ArgReader& reader) {
-  (void)reader;  // hide unused warning
-  value = constant;
+CPPARSE_INLINE bool read_fixed(const char* input, long double min,
+                               long double max, long double& output) {
+  char* end;
+  errno = 0;
+  output = std::strtold(input, &end);
+  return end != input && !*end && !errno && output >= min && output <= max;
 }
 
-template <typename T>
-Flag<T>& Flag<T>::help(const std::string& new_string) {
-  this->help_text.assign(new_string);
-  return *this;
+template <>
+CPPARSE_INLINE bool assign_fixed<bool>(void* storage, const char* input) {
+  bool& output = *static_cast<bool*>(storage);
+  if (!std::strcmp(input, "true") || !std::strcmp(input, "1")) {
+    output = true;
+  } else if (!std::strcmp(input, "false") || !std::strcmp(input, "0")) {
+    output = false;
+  } else {
+    return false;
+  }
+  return true;
 }
 
-template <typename T>
-const T& Flag<T>::get() const {
-  return value;
+template <>
+CPPARSE_INLINE bool assign_fixed<const char*>(void* storage,
+                                              const char* input) {
+  *static_cast<const char**>(storage) = input;  // argv outlives the parser
+  return true;
 }
 
-// --------
-// Argument
-// --------
-// An option or argument with one argument
-template <typename T>
-Argument<T>& Parser::add_optargument(
-    const std::string& name, char short_name, T def,
-    const std::function<T(const std::string&)> converter) {
-  auto* optarg = new Argument<T>(name, short_name, def, converter);
-  enroll_option(optarg);
-  return *optarg;
-}
-
-template <typename T>
-Argument<T>& Parser::add_optargument(
-    const std::string& name, T def,
-    const std::function<T(const std::string&)> converter) {
-  return Parser::add_optargument(name, '\0', def, converter);
-}
-
-template <typename T>
-Argument<T>& Parser::add_argument(
-    const std::string& name,
-    const std::function<T(const std::string&)> converter) {
-  auto* arg = new Argument<T>(name, '\0', T(), converter);
-  enroll_argument(arg);
-  return *arg;
-}
-
-template <typename T>
-Argument<T>::Argument(const std::string& name, char short_name, const T& def,
-                      const std::function<T(const std::string&)>& converter_)
-    : Option(name, short_name), value(def), converter(converter_) {}
-
-template <typename T>
-std::ostream& Argument<T>::format_args(std::ostream& os) {
-  // One arg is required so surrounded with <>
-  return os << " <" << this->name << '>';
+CPPARSE_INLINE void format_fixed_error(char* buffer, std::size_t size,
+                                       ParseError::Kind kind, const char* name,
+                                       const char* argument,
+                                       const char* type) {
+  // The same messages as ParseError, without its strings
+  switch (kind) {
+    case ParseError::Kind::unknown_option:
+      std::snprintf(buffer, size, "%s option \"%s\" is not a valid option",
+                    type, name);
+      break;
+    case ParseError::Kind::extra_argument:
+      std::snprintf(buffer, size,
+                    "Argument \"%s\" specified, but program demands no more "
+                    "arguments",
+                    name);
+      break;
+    case ParseError::Kind::invalid_argument:
+      std::snprintf(buffer, size,
+                    "Parse error trying to interpret '%s' argument \"%s\" as "
+                    "an '%s'",
+                    name, argument, type);
+      break;
+    case ParseError::Kind::missing_argument:
+      std::snprintf(buffer, size,
+                    "'%s' requires an argument, but none was specified", name);
+      break;
+    case ParseError::Kind::conflicting_options:
+      std::snprintf(buffer, size,
+                    "Options \"%s\" and \"%s\" can't be given together", name,
+                    argument);
+      break;
+    case ParseError::Kind::missing_companion:
+      std::snprintf(buffer, size, "Option \"%s\" requires option \"%s\"",
+                    name, argument);
+      break;
+    case ParseError::Kind::missing_choice:
+      std::snprintf(buffer, size, "%s of %s must be given", type, name);
+      break;
+    case ParseError::Kind::missing_options:
+      std::snprintf(buffer, size, "Missing required %s %s", type, name);
+      break;
+    case ParseError::Kind::mismatched_pattern:
+      std::snprintf(buffer, size,
+                    "'%s' argument \"%s\" doesn't match the pattern \"%s\"",
+                    name, argument, type);
+      break;
+  }
 }
 
-template <typename T>
-void Argument<T>::parse(ArgReader& reader) {
-  std::string buffer;
-  if (reader.next_argument(buffer)) {
-    try {
-      value = converter(buffer);
-    } catch (std::invalid_argument) {
-      reader.template parse_error<T>(this->name, buffer);
+CPPARSE_INLINE const Descriptor* find_fixed(const FixedTables& tables,
+                                            const char* name) {
+  for (std::size_t i = 0; i < tables.option_count; i++) {
+    if (!std::strcmp(tables.options[i].name, name)) {
+      return &tables.options[i];
     }
-  } else {
-    reader.required_argument(this->name);
   }
+  return nullptr;
 }
 
-template <typename T>
-Argument<T>& Argument<T>::help(const std::string& new_string) {
-  this->help_text.assign(new_string);
-  return *this;
+// Store `input` with `option`, or describe why it couldn't be. A null input
+// means there wasn't one.
+CPPARSE_INLINE bool store_fixed(const FixedTables& tables,
+                                const Descriptor& option, const char* input) {
+  if (!input) {
+    format_fixed_error(tables.error, tables.error_size,
+                       ParseError::Kind::missing_argument, option.name, "", "");
+    return false;
+  } else if (!option.assign(option.storage, input)) {
+    format_fixed_error(tables.error, tables.error_size,
+                       ParseError::Kind::invalid_argument, option.name, input,
+                       option.type_name);
+    return false;
+  }
+  return true;
 }
 
-template <typename T>
-const T& Argument<T>::get() const {
-  return value;
+// Reads argv the same way ArgReader does: short options can be bundled and
+// take the rest of their token as the value, and -- ends the options
+CPPARSE_INLINE bool parse_fixed(const FixedTables& tables, int argc,
+                                char** argv) {
+  tables.error[0] = '\0';
+  bool process_options = true;
+  std::size_t next = 0;  // Next positional argument
+  // The token after `i` if it can be a value
+  auto value_after = [&](int& i) -> const char* {
+    if (i + 1 >= argc || (process_options && argv[i + 1][0] == option_char)) {
+      return nullptr;
+    }
+    return argv[++i];
+  };
+
+  for (int i = 1; i < argc; i++) {
+    const char* token = argv[i];
+    if (process_options && token[0] == option_char &&
+        token[1] == option_char) {
+      if (!token[2]) {  // No more options
+        process_options = false;
+        continue;
+      }
+      const Descriptor* option = find_fixed(tables, token + 2);
+      if (!option) {
+        format_fixed_error(tables.error, tables.error_size,
+                           ParseError::Kind::unknown_option, token + 2, "",
+                           "Long");
+        return false;
+      } else if (!option->takes_argument) {
+        option->assign(option->storage, nullptr);
+      } else if (!store_fixed(tables, *option, value_after(i))) {
+        return false;
+      }
+
+    } else if (process_options && token[0] == option_char && token[1]) {
+      for (const char* flag = token + 1; *flag; flag++) {
+        auto short_name = static_cast<unsigned char>(*flag);
+        std::size_t index =
+            short_name < tables.short_count ? tables.short_options[short_name]
+                                            : 0;
+        if (!index) {
+          const char name[] = {*flag, '\0'};
+          format_fixed_error(tables.error, tables.error_size,
+                             ParseError::Kind::unknown_option, name, "",
+                             "Short");
+          return false;
+        }
+        const Descriptor& option = tables.options[index - 1];
+        if (!option.takes_argument) {
+          option.assign(option.storage, nullptr);
+          continue;
+        }
+        if (!store_fixed(tables, option, flag[1] ? flag + 1 : value_after(i))) {
+          return false;
+        }
+        break;  // The rest of the token was its value
+      }
+
+    } else if (next == tables.argument_count) {
+      format_fixed_error(tables.error, tables.error_size,
+                         ParseError::Kind::extra_argument, token, "", "");
+      return false;
+    } else if (!store_fixed(tables, tables.arguments[next++], token)) {
+      return false;
+    }
+  }
+  if (next < tables.argument_count) {
+    return store_fixed(tables, tables.arguments[next], nullptr);
+  }
+  return true;
 }
 
 // ---------------------
 // String Interpretation
 // ---------------------
-// Implementations of default string interpretations
-template <typename T>
-T read(const std::string& input) {
+CPPARSE_INLINE bool read_stream(const std::string& input,
+                                void (*extract)(std::istream&, void*),
+                                void* output) {
   std::istringstream iss(input);
-  T result;
-  iss >> std::boolalpha >> result;  // Read "true" as true
-  if (iss.eof() || iss.tellg() == int(input.size())) {
-    return result;
-  } else {
-    throw std::invalid_argument("Couldn't parse string");
-  }
+  iss >> std::boolalpha;  // Read "true" as true
+  extract(iss, output);
+  return iss.eof() || iss.tellg() == int(input.size());
 }
 
 // Needs to be specialized so that it takes the whole string and not only
 // whitespace
+#ifdef CPPARSE_NO_EXCEPTIONS
+template <>
+CPPARSE_INLINE bool read<std::string>(const std::string& input,
+                                      std::string& output) {
+  output = input;
+  return true;
+}
+#else
 template <>
-std::string read<std::string>(const std::string& input) {
+CPPARSE_INLINE std::string read<std::string>(const std::string& input) {
   return input;
 }
+#endif
+
+#ifdef CPPARSE_LIBRARY
+// -----------------------
+// Explicit Instantiations
+// -----------------------
+// The common instantiations live in libcpparse.a so includers can skip them
+template class BasicParser<>;
+CPPARSE_FLAG_INSTANTIATION_(, bool);
+CPPARSE_ARGUMENT_INSTANTIATION_(, int);
+CPPARSE_ARGUMENT_INSTANTIATION_(, double);
+CPPARSE_ARGUMENT_INSTANTIATION_(, std::string);
+CPPARSE_READ_INSTANTIATION_(, int);
+CPPARSE_READ_INSTANTIATION_(, double);
+#endif
 }
+
+#endif
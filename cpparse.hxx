@@ -1,53 +1,447 @@
 #ifndef CPPARSE_HXX
 #define CPPARSE_HXX
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
 #include <memory>
 #include <map>
 #include <vector>
 #include <string>
 
+// Non-template definitions are inline when this header pulls in the
+// implementation, and compiled once into libcpparse.a with CPPARSE_LIBRARY
+#ifdef CPPARSE_LIBRARY
+#define CPPARSE_INLINE
+#else
+#define CPPARSE_INLINE inline
+#endif
+
+// Builds without exceptions, e.g. with -fno-exceptions, are detected
+// automatically. Converters then report input they can't convert by returning
+// false, and mistakes in setting up a parser go to an error handler.
+#if !defined(__cpp_exceptions) && !defined(__EXCEPTIONS)
+#define CPPARSE_NO_EXCEPTIONS
+#endif
+
+// Building with CPPARSE_USDT adds USDT probes (sys/sdt.h) to the "cpparse"
+// provider, for bpftrace or perf to attach to on a running program:
+//   parse__start(argc)                   parse__end(failed)
+//   token(kind, bytes)                   kind is the ot read from argv
+//   convert__start(name, bytes)          convert__end(name, bytes, ok)
+//   format__start(help, options)         format__end(help, options)
+// `name` is the option's name, and `help` is 1 for help and 0 for usage.
+// Otherwise the probes compile to nothing.
+#ifdef CPPARSE_USDT
+#include <sys/sdt.h>
+#define CPPARSE_PROBE(name, ...) STAP_PROBEV(cpparse, name, __VA_ARGS__)
+#else
+#define CPPARSE_PROBE(name, ...) \
+  do {                           \
+  } while (0)
+#endif
+
 namespace cpparse {
 
 // '-' is used to signify optional arguments
 static const char option_char = '-';
 
+#ifdef CPPARSE_NO_EXCEPTIONS
+// Conversion of strings to values, false if the string can't be converted
+template <typename T>
+using Converter = std::function<bool(const std::string& input, T& output)>;
+
+// Default conversion of strings to types
+template <typename T>
+bool read(const std::string& input, T& output);
+
+template <>
+bool read<std::string>(const std::string& input, std::string& output);
+
+// Mistakes in setting up a parser, e.g. adding two options with the same name,
+// call this with a description. It shouldn't return; the default handler
+// prints the message and aborts.
+using ErrorHandler = void (*)(const char* message);
+
+void set_error_handler(ErrorHandler handler);
+#else
+// Conversion of strings to values, throws std::invalid_argument if the string
+// can't be converted
+template <typename T>
+using Converter = std::function<T(const std::string& input)>;
+
 // Default conversion of strings to types
 template <typename T>
 T read(const std::string& input);
 
 template <>
 std::string read<std::string>(const std::string& input);
+#endif
+
+// Name of `T` for error messages, taken from the compiler's own signature of
+// this function so that it works without RTTI
+template <typename T>
+const char* type_name();
+
+// Options defined anywhere in the program with CPPARSE_FLAG or CPPARSE_OPTION.
+// Every descriptor is constant initialized into its own linker section, so
+// defining one runs no code at startup, and each Parser picks them all up when
+// it's constructed.
+struct Descriptor {
+  const char* name;
+  char short_name;  // nonexistent if 0
+  const char* help;
+  const char* type_name;
+  void* storage;
+  bool takes_argument;
+  bool (*assign)(void* storage, const char* input);  // false if invalid
+};
+
+template <typename T>
+bool assign_descriptor(void* storage, const char* input);
+
+bool assign_descriptor_flag(void* storage, const char* input);
+
+#if defined(__GNUC__) && defined(__ELF__)
+#define CPPARSE_DESCRIPTOR_(ident)                                          \
+  static const ::cpparse::Descriptor cpparse_descriptor_##ident             \
+      __attribute__((used, section("cpparse_options"),                      \
+                     aligned(alignof(::cpparse::Descriptor))))
+
+// Define a boolean flag `ident` set by --name (or -short_name)
+#define CPPARSE_FLAG(ident, name, short_name, help)                         \
+  bool ident = false;                                                       \
+  CPPARSE_DESCRIPTOR_(ident) = {name, short_name, help, "bool", &ident,     \
+                                false, ::cpparse::assign_descriptor_flag}
+
+// Define an optional argument `ident` of `type`, default `def`. The type should
+// be constant initializable to keep startup free of code.
+#define CPPARSE_OPTION(type, ident, name, short_name, def, help)            \
+  type ident = def;                                                         \
+  CPPARSE_DESCRIPTOR_(ident) = {name, short_name, help, #type, &ident,      \
+                                true, ::cpparse::assign_descriptor<type>}
+
+// Use an option defined in another translation unit
+#define CPPARSE_DECLARE(type, ident) extern type ident
+#endif
 
 // Option classes and supporting classes
 // Option is an ABC that allows easy storage of all types
 class ArgReader;
 class Option;
+class Task;
 template <typename T>
 class Flag;
 template <typename T>
 class Argument;
+template <typename T>
+class VarArgument;
+template <typename T>
+class Reloadable;
+template <typename T>
+class Bound;
+class Binder;
+template <typename T>
+class MemoCache;
+
+template <typename... Policies>
+class BasicParser;
+
+// The parser with every default policy, see BasicParser
+using Parser = BasicParser<>;
+
+class UsageFormatter;
+class HelpFormatter;
+
+// Fast path for help and version, called before building a parser so that
+// trivial invocations skip registering every option. If a `-h` or `--help`
+// token comes first, prints the pre-rendered `help` (e.g. the output of --help
+// captured at build time) and exits, and likewise `version` for `--version`.
+// Scanning stops at `--`, and returns if neither was given or its text is null.
+void prescan(int argc, char** argv, const char* version, const char* help);
+
+// Signature of the `cpparse_register` function every plugin exports with C
+// linkage. It should add the plugin's options to the parser.
+using PluginRegister = void (*)(Parser& parser);
+
+// Parse Error
+// A problem with the command line. Printing one gives the message that parsers
+// exit with by default.
+struct ParseError {
+  enum class Kind {
+    unknown_option,    // `name` isn't an option, `type` is "Short" or "Long"
+    extra_argument,    // `name` is a positional argument nothing takes
+    invalid_argument,  // `argument` of `name` couldn't be converted to `type`
+    missing_argument,  // `name` takes an argument but none was given
+    conflicting_options,  // `name` and `argument` exclude each other
+    missing_companion,    // `name` was given without `argument`
+    missing_choice,  // None of `name`, a list, was given, `type` says how many
+    missing_options,  // Required `name`, a list, wasn't given, `type` is
+                      // "option" or "options"
+    mismatched_pattern  // `argument` of `name` doesn't match the pattern `type`
+  };
+
+  Kind kind;
+  std::string name;
+  std::string argument;
+  const char* type;
+};
+
+std::ostream& operator<<(std::ostream& os, const ParseError& error);
+
+// Parser View
+// What formatters see of a parser, with options sorted by name
+struct ParserView {
+  const std::string& program_name;
+  const std::string& description;
+  std::vector<Option*> options;
+  std::vector<Option*> arguments;
+  std::vector<std::string> help_entries;  // The help blob, expanded for help
+
+  // The help text of `option`, wherever it's kept
+  const std::string& help(const Option& option) const;
+};
+
+// Option Namespaces
+// Dotted option names like --db.pool.max-size are also kept in a trie with one
+// node per segment, so a lookup walks the name once rather than comparing the
+// shared prefix against every sibling. Help groups options by namespace.
+class OptionTrie {
+  struct Node {
+    std::vector<std::pair<std::string, std::size_t>> children;  // By segment
+    Option* option;  // Null if only a namespace
+  };
+  std::vector<Node> nodes;  // The root first
+
+ public:
+  OptionTrie();
+  // False, leaving the trie alone, if a segment of `path` is empty
+  bool insert(const std::string& path, Option* option);
+  // The option named `path`, or null
+  Option* find(const std::string& path) const;
+};
+
+// Constraint Groups
+// Relations between options, see BasicParser::add_group. Each option has a
+// dense id, and a group is a mask over those ids, so checking one against the
+// options given is a few word wide ands and popcounts.
+enum class Group {
+  exclusive,     // At most one may be given
+  exactly_one,   // One must be given, and no more
+  at_least_one,  // One or more must be given
+  together,      // All or none may be given
+  required       // Every one must be given, see BasicParser::require
+};
+
+struct ConstraintGroup {
+  Group kind;
+  std::vector<Option*> members;     // In the order they were named
+  std::vector<std::uint64_t> mask;  // Bit per member's id
+};
+
+// Compressed Help
+// Help text can be kept in one compressed blob in read only data, and only
+// expanded when help is printed. compress_help packs a list of entries, e.g.
+// at build time to be written out as an array, and options then refer to
+// their entry by index, see BasicParser::help_blob. The codec is a small LZ77
+// with byte aligned tokens.
+std::string compress_help(const std::vector<std::string>& entries);
+
+// Every entry of a blob made by compress_help
+std::vector<std::string> expand_help(const unsigned char* blob,
+                                     std::size_t size);
+
+// Parse Statistics
+// What a parser did in its last parse, see BasicParser::collect_stats. Phase
+// times are exclusive totals, since the phases interleave token by token:
+// tokenize is reading argv, dispatch finding and running options, convert
+// running converters (or waiting on expensive ones), validate the checks after
+// every token is read, and format rendering usage or help.
+struct ParseStats {
+  using Duration = std::chrono::nanoseconds;
+
+  struct Conversion {  // One converter call on the parsing thread
+    std::string option;
+    Duration time;
+  };
+
+  std::size_t tokens[5];    // Tokens read from argv, indexed by ot
+  std::size_t lookups;      // Probes into the option tables
+  std::size_t conversions;  // Converter calls, including expensive ones
+  std::size_t allocations;  // From the counter given to collect_stats
+  Duration tokenize;
+  Duration dispatch;
+  Duration convert;
+  Duration validate;
+  Duration format;
+  std::vector<Conversion> converted;
+
+  // The phase being timed and since when, see PhaseTimer
+  Duration ParseStats::*phase;
+  std::chrono::steady_clock::time_point since;
+
+  ParseStats();
+};
+
+// Write `stats` as Chrome trace event JSON, for chrome://tracing or Perfetto.
+// The phases are laid end to end, with each conversion inside convert.
+std::ostream& write_trace(std::ostream& os, const ParseStats& stats);
+
+// Capture
+// How an option's values are written to a capture corpus, see
+// BasicParser::capture. Only the value is changed, not an option bundled in
+// front of it, and its letters and digits are replaced with others of the same
+// kind. Hashing gives the same token for the same value, and a number one of
+// the same length no greater than it, so the shape of the traffic survives
+// and replaying it converts the same way.
+enum class Capture { keep, hash, redact };
+
+// Every command line in the corpus at `path`, e.g. to replay through a parser
+std::vector<std::vector<std::string>> read_corpus(const std::string& path);
+
+// Formatters
+// Render usage and help for the Formatter policy
+struct WrappedFormatter {  // Wrapped to 80 columns with aligned help text
+  static std::ostream& usage(std::ostream& os, const ParserView& view);
+  static std::ostream& help(std::ostream& os, const ParserView& view);
+};
+
+struct PlainFormatter {  // One line per option, without the wrapping code
+  static std::ostream& usage(std::ostream& os, const ParserView& view);
+  static std::ostream& help(std::ostream& os, const ParserView& view);
+};
+
+// Error Sinks
+// Receive every parse error for the ErrorSink policy. Parsing stops after the
+// first error, and parse returns false if the sink returned.
+struct ExitSink {  // Print the error and usage to stderr and exit with 1
+  void report(const ParseError& error, const UsageFormatter& usage);
+};
+
+struct FirstErrorSink {  // Keep the first error for the caller
+  bool failed;
+  ParseError error;
+
+  FirstErrorSink();
+  void report(const ParseError& error, const UsageFormatter& usage);
+};
+
+// Policies
+// BasicParser takes any number of these, each replacing one of the defaults:
+// Lookup is the map from option names to options, Allocator the allocator of
+// the parser's containers, ErrorSink where parse errors go, and Formatter how
+// usage and help are rendered.
+struct DefaultPolicies {
+  template <typename Key, typename Value, typename Alloc>
+  using Lookup = std::map<Key, Value, std::less<Key>, Alloc>;
+  template <typename T>
+  using Allocator = std::allocator<T>;
+  using ErrorSink = ExitSink;
+  using Formatter = WrappedFormatter;
+};
+
+// A std::unordered_map, defined in cpparse_parser.hxx
+template <typename Key, typename Value, typename Alloc>
+class HashedMap;
+
+// Hashed lookup, for tools with very many options
+struct HashedLookup : virtual DefaultPolicies {
+  template <typename Key, typename Value, typename Alloc>
+  using Lookup = HashedMap<Key, Value, Alloc>;
+};
+
+// Allocate the parser's containers with `Alloc`
+template <template <typename> class Alloc>
+struct AllocateWith : virtual DefaultPolicies {
+  template <typename T>
+  using Allocator = Alloc<T>;
+};
+
+// Keep the first error instead of exiting, see BasicParser::errors
+struct ReturnErrors : virtual DefaultPolicies {
+  using ErrorSink = FirstErrorSink;
+};
+
+// Unwrapped usage and help
+struct PlainHelp : virtual DefaultPolicies {
+  using Formatter = PlainFormatter;
+};
+
+// The defaults with `Policies` on top. Each policy derives virtually from the
+// defaults, so the members it declares dominate theirs. With CPPARSE_LIBRARY
+// only the default policies are compiled into the library, so parsers with
+// any others need cpparse_parser.hxx included as well.
+template <typename... Policies>
+struct PolicySet : virtual DefaultPolicies, Policies... {};
 
 // Parser object
 // This controls all of the parsing, and is the main point of api entry
-class Parser {
-  std::map<std::string, std::unique_ptr<Option>> options;
-  std::map<char, Option*> short_options;
-  std::vector<std::unique_ptr<Option>> arguments;
+template <typename... Policies>
+class BasicParser {
+  using Policy = PolicySet<Policies...>;
+  template <typename Key, typename Value>
+  using Lookup = typename Policy::template Lookup<
+      Key, Value,
+      typename Policy::template Allocator<std::pair<const Key, Value>>>;
+  template <typename T>
+  using Vector = std::vector<T, typename Policy::template Allocator<T>>;
+
+  struct Plugin {
+    std::string path;
+    void* handle;  // nullptr until loaded
+  };
+
+  Lookup<std::string, std::unique_ptr<Option>> options;
+  Lookup<char, Option*> short_options;
+  OptionTrie namespaces;  // Every dotted option
+  Vector<std::unique_ptr<Option>> arguments;
+  bool variadic;  // Whether the last argument takes all remaining values
+  Option* help_option;  // Null if help is disabled
+  ConstraintGroup required;  // Checked before the other groups
+  Vector<ConstraintGroup> groups;
+
+  Vector<Plugin> plugins;
+  Lookup<std::string, std::size_t> plugin_options;  // Not yet loaded
+  Lookup<char, std::size_t> plugin_short_options;
 
   std::string program_name;
   std::string description;
+  typename Policy::ErrorSink sink;
+
+  const unsigned char* help_data;  // Compressed help, see help_blob
+  std::size_t help_size;
+
+  std::string capture_path;            // Empty unless capturing
+  bool collecting;                     // Whether to fill in statistics
+  std::size_t (*count_allocations)();  // Null if allocations aren't counted
+  mutable ParseStats statistics;       // Mutable since formatting is timed
 
   void enroll_option(Option* option);
   void enroll_argument(Option* argument);
+  Option* find_option(const std::string& name);
+  void load_plugin(std::size_t index);
+  bool parse_all(int argc, char** argv, bool strict);
+  void parse_tokens(ArgReader& reader, int argc, char** argv, bool strict);
+  static void join_pending(ArgReader& reader);
+  ParseStats* begin_stats();
+  void end_stats();
+
+  // Type erased hooks for the formatters and ArgReader
+  ParserView view() const;
+  static std::ostream& format_usage(std::ostream& os, const void* parser);
+  static std::ostream& format_help(std::ostream& os, const void* parser);
+  static void report(void* parser, const ParseError& error);
 
  public:
   // Classes that overload << to allow easy formatting of help and usage in
   // streams
-  class UsageFormatter;
-  class HelpFormatter;
+  using UsageFormatter = cpparse::UsageFormatter;
+  using HelpFormatter = cpparse::HelpFormatter;
+  using ErrorSink = typename Policy::ErrorSink;
 
   // Only constructor
-  Parser(const std::string& description = "", bool enable_help = true);
+  BasicParser(const std::string& description = "", bool enable_help = true);
 
   // Add a flag (no arguments) with a short name
   template <typename T = bool>
@@ -58,26 +452,121 @@ class Parser {
   template <typename T = bool>
   Flag<T>& add_flag(const std::string& name, T constant, T def = T());
 
+  // Take the help text of options given help_entry from `blob`, made by
+  // compress_help. The blob isn't copied, so it should be static, and it's only
+  // expanded when help is printed.
+  void help_blob(const unsigned char* blob, std::size_t size);
+
+  // Set the name shown in usage, otherwise taken from argv[0] when parsing
+  void set_program_name(const std::string& name);
+
+  // Add a --version flag that prints `version` and exits
+  void add_version(const std::string& version);
+
   // Add an optional argument (one arg) not required
   template <typename T = std::string>
   Argument<T>& add_optargument(
       const std::string& name, char short_name, T def = T(),
-      const std::function<T(const std::string&)> converter = read<T>);
+      const Converter<T> converter = read<T>);
 
   // Add an optional argument (one arg) not required
   template <typename T = std::string>
-  Argument<T>& add_optargument(
-      const std::string& name, T def = T(),
-      const std::function<T(const std::string&)> converter = read<T>);
+  Argument<T>& add_optargument(const std::string& name, T def = T(),
+                               const Converter<T> converter = read<T>);
 
   // A mandatory positional argument
   template <typename T = std::string>
-  Argument<T>& add_argument(
-      const std::string& name,
-      const std::function<T(const std::string&)> converter = read<T>);
+  Argument<T>& add_argument(const std::string& name,
+                            const Converter<T> converter = read<T>);
+
+  // Zero or more positional arguments collected into a vector. This must be the
+  // last positional argument added
+  template <typename T = std::string>
+  VarArgument<T>& add_varargument(const std::string& name,
+                                  const Converter<T> converter = read<T>);
+
+  // An optional argument whose value can be replaced after parsing, while
+  // other threads keep reading it
+  template <typename T = std::string>
+  Reloadable<T>& add_reloadable(
+      const std::string& name, char short_name, T def = T(),
+      const Converter<T> converter = read<T>);
+
+  // See above, without a short name
+  template <typename T = std::string>
+  Reloadable<T>& add_reloadable(const std::string& name, T def = T(),
+                                const Converter<T> converter = read<T>);
+
+  // Add an option for every field of `tree` and of the structs nested in it,
+  // named <name_space>.<field>, see Binder
+  template <typename S>
+  void bind(const std::string& name_space, S& tree);
+
+  // Constrain the options called `names`, e.g. add_group(Group::together,
+  // {"tls-cert", "tls-key"}). Groups are checked once every token has been
+  // read, and the first one broken is reported naming the options involved.
+  void add_group(Group kind, const std::vector<std::string>& names);
+
+  // Make the options called `names` required, like positional arguments. Every
+  // required option missing from a command line is reported in one error.
+  void require(const std::vector<std::string>& names);
+
+  // Defer the options of plugins until they're used. The manifest has one
+  // plugin per line, `path option...`, where single characters are short
+  // names. A plugin is only loaded, and its `cpparse_register` called, when
+  // one of its options is given or full help is requested. Plugins register
+  // with a Parser, so this only compiles for one.
+  void add_plugins(const std::string& manifest);
+
+  // Load every deferred plugin now, e.g. before printing help by hand
+  void load_plugins();
+
+  // Call this after adding all of the options. Returns false if there was an
+  // error and the error sink returned instead of exiting.
+  bool parse(int argc, char** argv);
+
+  // Parse only the options this parser knows, skipping unknown options and
+  // extra arguments instead of exiting. argv is left untouched, so a small
+  // bootstrap parser with e.g. --config can run before the full one is built.
+  // Help is skipped too, so that the full parser prints the full help.
+  bool parse_known(int argc, char** argv);
+
+  // Like parse, but returns once every option that isn't expensive has been
+  // converted. The task is ready when the expensive conversions are done, and
+  // until then `get` on an expensive option waits for that option alone.
+  // Errors are reported in the same order as parse, but those found in the
+  // background only reach the error sink when a thread waits for the task (or
+  // gets the option that failed), and then on that thread. get on the task
+  // returns false if there was an error.
+  Task parse_async(int argc, char** argv);
+
+  // The error sink, e.g. to get the error a ReturnErrors parser kept. It's
+  // reset at the start of every parse.
+  const ErrorSink& errors() const;
+
+  // Record ParseStats for every following parse. `allocations`, if given,
+  // should return how many allocations the program has made so far, e.g.
+  // counted by its own operator new. parse_async counts them until it returns.
+  void collect_stats(std::size_t (*allocations)() = nullptr);
+
+  // Statistics of the last parse, complete once it returns (for parse_async,
+  // once its task has been waited for, which adds those of the background)
+  const ParseStats& stats() const;
 
-  // Call this after adding all of the options
-  void parse(int argc, char** argv);
+  // Append every command line parsed from now on to the corpus at `path`, with
+  // values written as each option's capture setting says. Failing to write the
+  // corpus is ignored, so capturing never breaks the program.
+  void capture(const std::string& path);
+
+  // Update a reloadable option by name, running its normal converter. Returns
+  // false, leaving the value alone, if there is no such reloadable option or
+  // the value can't be converted.
+  bool set(const std::string& name, const std::string& value);
+
+  // Set reloadable options from a file with one `name value` or `name=value`
+  // per line. Blank lines and lines starting with # are skipped. Returns false
+  // if any line couldn't be applied, after applying the rest.
+  bool reload(const std::string& path);
 
   // Objects that overload <<
   // i.e. to print help `cout << parser.help();`
@@ -85,6 +574,119 @@ class Parser {
   HelpFormatter help() const;
 };
 
+// Fixed capacity parser
+// A parser that never allocates, for code such as a child between vfork and
+// exec. Every table lives in the object, sized by the template parameters,
+// and values are written straight into variables the caller owns. Values can
+// be numbers, bool, or const char* pointing into argv. Lookups are linear, so
+// this is meant for a handful of options. Mistakes in setting it up, including
+// running out of capacity, still go through the usual error path.
+struct FixedTables;
+
+template <std::size_t MaxOptions, std::size_t MaxArguments,
+          std::size_t NameBytes = 32 * MaxOptions>
+class FixedParser {
+  static_assert(MaxOptions < 255, "short options are indexed by a byte");
+
+  Descriptor options[MaxOptions];
+  unsigned char short_options[128];  // Index + 1 into options, 0 if none
+  Descriptor arguments[MaxArguments];
+  std::size_t option_count;
+  std::size_t argument_count;
+
+  char names[NameBytes];  // Copies of every name, each ending with '\0'
+  std::size_t name_bytes;
+  char error_message[192];
+
+  const char* copy_name(const char* name);
+  void enroll_option(const Descriptor& option);
+  FixedTables tables();
+
+ public:
+  FixedParser();
+
+  // Set `storage` to true when --name (or -short_name) is given
+  void add_flag(const char* name, char short_name, bool& storage,
+                const char* help = "");
+
+  // An optional argument, leaving `storage` alone when not given
+  template <typename T>
+  void add_option(const char* name, char short_name, T& storage,
+                  const char* help = "");
+
+  // A required positional argument
+  template <typename T>
+  void add_argument(const char* name, T& storage, const char* help = "");
+
+  // Returns false at the first error, leaving its message in error()
+  bool parse(int argc, char** argv);
+
+  // Message of the last error, empty if there wasn't one
+  const char* error() const;
+};
+
+// Store conversions for FixedParser, which can't use read<T> since streams
+// allocate. Numbers must fit in T and nothing may follow them, and a bool is
+// "true" or "false" like in Parser, or else 1 or 0.
+template <typename T>
+bool assign_fixed(void* storage, const char* input);
+
+template <>
+bool assign_fixed<bool>(void* storage, const char* input);
+template <>
+bool assign_fixed<const char*>(void* storage, const char* input);
+
+// Pattern
+// A regular expression compiled into a DFA when it's constructed, so checking
+// a token is one table lookup per character with no backtracking. Supports a
+// common subset: literals, `.`, classes like [a-z_] and [^/], the escapes \d
+// \w \s (and \D \W \S), `\` before any other character, groups, |, *, +, ?
+// and {m}, {m,} or {m,n}. Patterns always match the whole token, so there are
+// no anchors. Invalid or overly large patterns fail like other setup mistakes.
+class Pattern {
+  std::string source;
+  unsigned char classes[256];  // Bytes that always transition alike
+  std::size_t class_count;
+  std::vector<int> transitions;  // By state then class, -1 if no match
+  std::vector<bool> accepting;   // By state, the start state being 0
+
+ public:
+  explicit Pattern(const std::string& source);
+  // Whether all of `input` matches
+  bool matches(const std::string& input) const;
+  // The pattern as written
+  const std::string& text() const;
+};
+
+// Task
+// Work queued on the shared worker pool, shared by everything waiting on it. A
+// thread that waits before a worker has picked the work up runs it itself, so
+// tasks waiting on tasks can't starve the pool. Kept opaque so that this header
+// doesn't need <thread>.
+class Task {
+  struct State;
+  std::shared_ptr<State> state;
+
+ public:
+  // No work, see valid
+  Task();
+  // Run `work` on a worker thread
+  explicit Task(const std::function<bool()>& work);
+  // Same, then pass its result through `finish` on the first thread to wait
+  // for it, giving the result of the task
+  Task(const std::function<bool()>& work,
+       const std::function<bool(bool)>& finish);
+
+  // Whether there is work, finished or not
+  bool valid() const;
+  // Whether the work has finished, so get won't wait
+  bool ready() const;
+  // Wait for the work (and its finish) to be done
+  void wait() const;
+  // Wait for the work, then return its result or rethrow what it threw
+  bool get() const;
+};
+
 // Option
 // Abstract base class of all ways to get input data
 class Option {
@@ -92,24 +694,78 @@ class Option {
   const std::string name;
   const char short_name;  // nonexistent if 0
   std::string help_text;
+  std::size_t help_index;  // Entry in the parser's help blob, if not npos
+  std::size_t id;          // Dense index among the parser's options
+  bool required;           // See BasicParser::require
+  std::shared_ptr<const Pattern> token_pattern;  // Tokens must match, if set
+  Task parsed;              // Set while parse_async is still joining
+  Capture capture_mode;             // How values go into a capture corpus
 
   Option(const std::string& name, char short_name);
   virtual ~Option();
   virtual std::ostream& format_args(std::ostream& os);
   virtual void parse(ArgReader& reader);
+  // Wait for any conversion parse started in the background
+  virtual void join(ArgReader& reader);
+  // Replace the value after parsing, false if unsupported or invalid
+  virtual bool reload(const std::string& input);
+};
+
+// Single value engine
+// Everything about options with one argument that doesn't depend on the value
+// type: reading the token, deferring, and reporting errors. It's compiled once,
+// so each type only adds its conversion.
+class SingleOption : public Option {
+ protected:
+  const char* const type_name;  // Reported in parse errors
+  bool deferred;                // Convert on a worker thread
+  std::string token;            // Input of a deferred conversion
+  Task pending;                 // Result of a deferred conversion
+
+  SingleOption(const std::string& name, char short_name,
+               const char* type_name);
+  std::ostream& format_args(std::ostream& os) override;
+  void parse(ArgReader& reader) override;
+  void join(ArgReader& reader) override;
+
+  // Convert `input` and store it, false if it couldn't be converted. Deferred
+  // conversions call this on a worker thread.
+  virtual bool store(const std::string& input) = 0;
+  // store, between the convert probes
+  bool convert(const std::string& input);
+};
+
+// Multiple value engine
+// The same for options that take every remaining argument
+class MultiOption : public Option {
+ protected:
+  const char* const type_name;  // Reported in parse errors
+  std::vector<std::string> tokens;  // Collected so far in this parse
+
+  MultiOption(const std::string& name, const char* type_name);
+  std::ostream& format_args(std::ostream& os) override;
+  // Collects the values up to the next option. Called again for the values
+  // after each later option, so they all end up in one batch.
+  void parse(ArgReader& reader) override;
+  // Converts every value collected, once all tokens have been read
+  void join(ArgReader& reader) override;
+
+  // Convert and store all of `tokens`. Returns the index of the first token
+  // that couldn't be converted, or the number of tokens on success.
+  virtual std::size_t store_all(const std::vector<std::string>& tokens) = 0;
 };
 
 // Flag (no arguments)
 // Visible api is basically the same to every type
 template <typename T>
 class Flag : Option {
-  friend class Parser;
+  template <typename...>
+  friend class BasicParser;
   T value;
   const T constant;
 
   Flag(const std::string& name, char short_name, const T& constant,
        const T& def);
-  std::ostream& format_args(std::ostream& os) override;
   void parse(ArgReader& reader) override;
 
   ~Flag() override{};
@@ -119,30 +775,287 @@ class Flag : Option {
   const T& get() const;
   // Set the help text of this option
   Flag& help(const std::string& new_help);
+  // Use entry `entry` of the parser's help blob as the help text, see
+  // BasicParser::help_blob
+  Flag& help_entry(std::size_t entry);
 };
 
 // Argument (one argument)
 template <typename T>
-class Argument : Option {
-  friend class Parser;
+class Argument : SingleOption {
+  template <typename...>
+  friend class BasicParser;
   T value;
-  const std::function<T(const std::string&)> converter;
+  const Converter<T> converter;
+  std::shared_ptr<MemoCache<T>> cache;  // Previously converted values
+  std::shared_ptr<const T> cached;      // Value handed out by the cache
 
   Argument(const std::string& name, char short_name, const T& def,
-           const std::function<T(const std::string&)>& converter);
-  std::ostream& format_args(std::ostream& os) override;
-  void parse(ArgReader& reader) override;
+           const Converter<T>& converter);
+  bool store(const std::string& input) override;
 
   ~Argument() override{};
 
  public:
-  // See Flag
+  // See Flag, waits if the conversion is still running
   const T& get() const;
+  // Whether get can return without waiting for a background conversion
+  bool ready() const;
   // See Flag
   Argument& help(const std::string& new_help);
+  // See Flag
+  Argument& help_entry(std::size_t entry);
+  // Mark the converter as expensive. Its conversion will run on a worker
+  // thread alongside other expensive conversions, and parse will wait for all
+  // of them before returning.
+  Argument& expensive();
+  // Remember up to `capacity` converted values, so a repeated token reuses the
+  // earlier result instead of being converted again
+  Argument& memoize(std::size_t capacity);
+  // Same as above, but with a cache that can be shared with other options and
+  // parsers. Values are converted by the cache's converter rather than this
+  // option's, so a token means the same thing to every option sharing it.
+  Argument& memoize(const std::shared_ptr<MemoCache<T>>& shared_cache);
+  // Hash or redact values in capture corpora, see BasicParser::capture
+  Argument& capture(Capture mode);
+  // Only accept tokens that match `regex` (see Pattern), checked before
+  // converting. The pattern is shown in help.
+  Argument& pattern(const std::string& regex);
+};
+
+// Variable argument (zero or more arguments)
+template <typename T>
+class VarArgument : MultiOption {
+  template <typename...>
+  friend class BasicParser;
+  std::vector<T> value;
+  const Converter<T> converter;
+
+  VarArgument(const std::string& name, const Converter<T>& converter);
+  std::size_t store_all(const std::vector<std::string>& tokens) override;
+
+  ~VarArgument() override{};
+
+ public:
+  // See Flag
+  const std::vector<T>& get() const;
+  // See Flag
+  VarArgument& help(const std::string& new_help);
+  // See Flag
+  VarArgument& help_entry(std::size_t entry);
+  // See Argument
+  VarArgument& capture(Capture mode);
+};
+
+// Published values
+// The current value of a Reloadable. get is a single acquire load of the
+// current pointer, for threads that don't overlap updates. snapshot shares
+// ownership of the current value, which is freed once the last snapshot of it
+// is released after it has been replaced.
+class Snapshots {
+  struct State;  // The current pointer and the value that owns it
+  const std::unique_ptr<State> state;
+
+ public:
+  explicit Snapshots(std::shared_ptr<const void> initial);
+  ~Snapshots();
+  const void* get() const;
+  std::shared_ptr<const void> snapshot() const;
+  void publish(std::shared_ptr<const void> next);
+};
+
+// Reloadable (one argument, replaceable at runtime)
+// See Snapshots for how the value is shared with readers
+template <typename T>
+class Reloadable : SingleOption {
+  template <typename...>
+  friend class BasicParser;
+  Snapshots snapshots;
+  const Converter<T> converter;
+
+  Reloadable(const std::string& name, char short_name, const T& def,
+             const Converter<T>& converter);
+  bool store(const std::string& input) override;
+  bool reload(const std::string& input) override;
+
+  ~Reloadable() override{};
+
+ public:
+  // See Flag. The reference is only valid until the next update, so threads
+  // reading while another updates (e.g. a Watcher) should use snapshot.
+  const T& get() const;
+  // The current value, kept alive for as long as the caller holds it however
+  // often the value is updated meanwhile
+  std::shared_ptr<const T> snapshot() const;
+  // Convert `input` and publish it as the new value. Returns false, leaving
+  // the value alone, if it can't be converted.
+  bool set(const std::string& input);
+  // See Flag
+  Reloadable& help(const std::string& new_help);
+  // See Flag
+  Reloadable& help_entry(std::size_t entry);
+  // See Argument
+  Reloadable& capture(Capture mode);
+};
+
+// Bound (one argument, stored in the caller's variable)
+// An optional argument that converts straight into a member of a struct bound
+// with BasicParser::bind. The variable keeps its value when not given.
+template <typename T>
+class Bound : SingleOption {
+  friend class Binder;
+  T& storage;
+  const Converter<T> converter;
+
+  Bound(const std::string& name, T& storage, const Converter<T>& converter);
+  bool store(const std::string& input) override;
+
+  ~Bound() override{};
+
+ public:
+  // See Flag
+  Bound& help(const std::string& new_help);
+  // See Flag
+  Bound& help_entry(std::size_t entry);
+  // See Argument
+  Bound& capture(Capture mode);
+};
+
+// Binder
+// Registers the fields of a struct under a namespace. BasicParser::bind calls
+// `cpparse_bind(Binder&, S&)`, found by argument dependent lookup, which adds
+// each field with `field` and each nested struct with `group`, e.g.
+//
+//   void cpparse_bind(cpparse::Binder& b, Pool& pool) {
+//     b.field("max-size", pool.max_size).help("Most open connections");
+//   }
+class Binder {
+  std::function<void(Option*)> enroll;
+  std::string prefix;  // The namespace, ending with '.'
+
+ public:
+  Binder(const std::function<void(Option*)>& enroll,
+         const std::string& name_space);
+
+  // Add --<namespace>.<name>, converted into `storage`
+  template <typename T>
+  Bound<T>& field(const std::string& name, T& storage,
+                  const Converter<T> converter = read<T>);
+
+  // Bind the fields of `nested` under <namespace>.<name>
+  template <typename S>
+  void group(const std::string& name, S& nested);
+};
+
+#ifdef __linux__
+// Config Watcher
+// Reloads a config file into a parser whenever it's written or replaced, using
+// inotify on a background thread. The watch stops when this is destroyed.
+// Superseded Reloadable values are freed once no snapshot holds them.
+class Watcher {
+  struct Thread;
+
+  const std::function<void(const std::string&)> reload;
+  const std::string path;
+  int inotify;  // Watches the directory so renames over the file are seen
+  int wake;     // Written to on destruction to stop the thread
+  std::unique_ptr<Thread> thread;
+
+  void run();
+  Watcher(const std::function<void(const std::string&)>& reload,
+          const std::string& path);
+
+ public:
+  template <typename... Policies>
+  Watcher(BasicParser<Policies...>& parser, const std::string& path)
+      : Watcher([&parser](const std::string& file) { parser.reload(file); },
+                path) {}
+  ~Watcher();
+
+  Watcher(const Watcher&) = delete;
+  Watcher& operator=(const Watcher&) = delete;
+};
+#endif
+
+// Memoizing Cache
+// Bounded map from raw tokens to converted values, evicting the least recently
+// used. Values are shared immutable handles, so a hit never copies. Safe to use
+// from several threads at once.
+class MemoTable {
+  struct State;  // The entries, in order of use
+  const std::unique_ptr<State> state;
+
+ protected:
+  explicit MemoTable(std::size_t capacity);
+  ~MemoTable();
+
+  // Get the value of `input`, calling `convert` only if it isn't cached
+  std::shared_ptr<const void> lookup(
+      const std::string& input,
+      const std::function<std::shared_ptr<const void>(const std::string&)>&
+          convert);
+};
+
+// The typed face of a MemoTable. Entries are only keyed by token, so the cache
+// owns the converter that made them, and every option sharing it converts
+// with that one.
+template <typename T>
+class MemoCache : MemoTable {
+  const Converter<T> converter;
+
+ public:
+  explicit MemoCache(std::size_t capacity,
+                     const Converter<T>& converter = read<T>);
+
+  // Get the converted value of `input`, converting only if it isn't cached.
+  // Null if `input` can't be converted, which is never cached.
+  std::shared_ptr<const T> convert(const std::string& input);
 };
 }
 
+#include "cpparse_templates.hxx"
+#ifndef CPPARSE_LIBRARY
+#include "cpparse_parser.hxx"
+#endif
+
+// Instantiations of a Flag or Argument type, and the Parser methods that add
+// them. `prefix` is extern to declare them, or empty to define them.
+#define CPPARSE_FLAG_INSTANTIATION_(prefix, T)                            \
+  prefix template class Flag<T>;                                          \
+  prefix template Flag<T>& Parser::add_flag<T>(const std::string&, char,  \
+                                               T, T);                     \
+  prefix template Flag<T>& Parser::add_flag<T>(const std::string&, T, T)
+
+#define CPPARSE_ARGUMENT_INSTANTIATION_(prefix, T)                        \
+  prefix template class Argument<T>;                                      \
+  prefix template Argument<T>& Parser::add_optargument<T>(                \
+      const std::string&, char, T, Converter<T>);                         \
+  prefix template Argument<T>& Parser::add_optargument<T>(                \
+      const std::string&, T, Converter<T>);                               \
+  prefix template Argument<T>& Parser::add_argument<T>(                   \
+      const std::string&, Converter<T>)
+
+#ifdef CPPARSE_NO_EXCEPTIONS
+#define CPPARSE_READ_INSTANTIATION_(prefix, T) \
+  prefix template bool read<T>(const std::string&, T&)
+#else
+#define CPPARSE_READ_INSTANTIATION_(prefix, T) \
+  prefix template T read<T>(const std::string&)
+#endif
+
+#ifdef CPPARSE_LIBRARY
+// Compiled into libcpparse.a, see the end of cpparse.cxx
+namespace cpparse {
+extern template class BasicParser<>;
+CPPARSE_FLAG_INSTANTIATION_(extern, bool);
+CPPARSE_ARGUMENT_INSTANTIATION_(extern, int);
+CPPARSE_ARGUMENT_INSTANTIATION_(extern, double);
+CPPARSE_ARGUMENT_INSTANTIATION_(extern, std::string);
+CPPARSE_READ_INSTANTIATION_(extern, int);
+CPPARSE_READ_INSTANTIATION_(extern, double);
+}
+#else
 #include "cpparse.cxx"
+#endif
 
 #endif
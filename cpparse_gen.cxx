@@ -0,0 +1,663 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "cpparse.hxx"
+
+using namespace std;
+using namespace cpparse;
+
+// Generates a header with a parser specialized to one spec. Long options are
+// matched by a switch over their characters, short options by a table, and
+// usage and help are rendered ahead of time by a runtime Parser built from the
+// same spec, so the output is identical. The generated class has a `parse`
+// method and one member per option with a `get` method, so it can stand in for
+// a runtime Parser without changing the code that reads values.
+//
+// Usage shows argv[0] like a runtime Parser, unless the spec fixes the name
+// with `program`, and is wrapped for it when printed. Dotted option names like
+// log.level become members with underscores, log_level.
+//
+// A spec has one entry per line, blank lines and lines starting with # are
+// ignored. Types, defaults and constants are C++ without spaces, `-` means no
+// short name or a default constructed value, and help is the rest of the line.
+// With compresshelp the rendered help is embedded compressed, see
+// cpparse::compress_help, and only expanded the first time it's printed.
+//
+//   program <name>
+//   class <identifier>
+//   description <text>
+//   version <text>
+//   nohelp
+//   compresshelp
+//   flag <type> <name> <short> <constant> <default> <help>
+//   option <type> <name> <short> <default> <help>
+//   argument <type> <name> <help>
+//   varargument <type> <name> <help>
+
+enum class kind { flag, option, argument, varargument, help, version };
+
+struct Entry {
+  kind type;
+  string cpp_type;
+  string name;
+  char short_name;
+  string constant;
+  string def;
+  string help;
+  string identifier;
+};
+
+struct Spec {
+  string program;  // Empty to show argv[0]
+  string class_name = "GeneratedParser";
+  string description;
+  string version;
+  bool enable_help = true;
+  bool compressed_help = false;
+  vector<Entry> options;    // In spec order
+  vector<Entry> arguments;  // In spec order
+};
+
+// Option names can contain dashes and dots and clash with keywords
+string identifier(const string& name) {
+  static const set<string> keywords = {
+      "auto",   "bool",     "break",  "case",     "char",   "class",
+      "const",  "continue", "default", "delete",  "do",     "double",
+      "else",   "enum",     "extern", "false",    "float",  "for",
+      "goto",   "if",       "inline", "int",      "long",   "namespace",
+      "new",    "operator", "private", "public",  "return", "short",
+      "signed", "sizeof",   "static", "struct",   "switch", "template",
+      "this",   "throw",    "true",   "try",      "typedef", "union",
+      "unsigned", "using",  "virtual", "void",    "while",  "parse",
+      "usage",  "help"};
+  string result(name);
+  replace(result.begin(), result.end(), '-', '_');
+  replace(result.begin(), result.end(), '.', '_');
+  if (keywords.count(result)) {
+    result.push_back('_');
+  }
+  return result;
+}
+
+string rest_of_line(istringstream& words) {
+  string rest;
+  getline(words, rest);
+  auto begin = rest.find_first_not_of(" \t");
+  return begin == string::npos ? "" : rest.substr(begin);
+}
+
+Spec read_spec(const string& path) {
+  ifstream file(path);
+  if (!file) {
+    cerr << "Couldn't open spec \"" << path << "\"\n";
+    exit(1);
+  }
+
+  Spec spec;
+  string line;
+  unsigned number = 0;
+  while (getline(file, line)) {
+    number++;
+    istringstream words(line);
+    string keyword;
+    if (!(words >> keyword) || keyword[0] == '#') {
+      continue;
+    }
+
+    Entry entry{kind::flag, "", "", '\0', "", "", "", ""};
+    string short_name;
+    if (keyword == "program") {
+      words >> spec.program;
+    } else if (keyword == "class") {
+      words >> spec.class_name;
+    } else if (keyword == "description") {
+      spec.description = rest_of_line(words);
+    } else if (keyword == "version") {
+      spec.version = rest_of_line(words);
+    } else if (keyword == "nohelp") {
+      spec.enable_help = false;
+    } else if (keyword == "compresshelp") {
+      spec.compressed_help = true;
+    } else if (keyword == "flag" &&
+               words >> entry.cpp_type >> entry.name >> short_name >>
+                   entry.constant >> entry.def) {
+      entry.type = kind::flag;
+    } else if (keyword == "option" && words >> entry.cpp_type >> entry.name >>
+                                          short_name >> entry.def) {
+      entry.type = kind::option;
+    } else if (keyword == "argument" && words >> entry.cpp_type >> entry.name) {
+      entry.type = kind::argument;
+    } else if (keyword == "varargument" &&
+               words >> entry.cpp_type >> entry.name) {
+      entry.type = kind::varargument;
+    } else {
+      cerr << path << ':' << number << ": couldn't read \"" << line << "\"\n";
+      exit(1);
+    }
+
+    if (entry.name.empty()) {
+      continue;
+    }
+    if (short_name.size() > 1) {
+      cerr << path << ':' << number << ": short name \"" << short_name
+           << "\" isn't a single character\n";
+      exit(1);
+    }
+    entry.short_name = short_name == "-" ? '\0' : short_name[0];
+    entry.def = entry.def == "-" ? "" : entry.def;
+    entry.help = rest_of_line(words);
+    entry.identifier = identifier(entry.name);
+    if (entry.type == kind::flag || entry.type == kind::option) {
+      spec.options.push_back(entry);
+    } else {
+      spec.arguments.push_back(entry);
+    }
+  }
+
+  // Names that only differ in punctuation would become the same member
+  map<string, string> members;
+  for (const auto* entries : {&spec.options, &spec.arguments}) {
+    for (const auto& entry : *entries) {
+      auto member = members.emplace(entry.identifier, entry.name);
+      if (!member.second) {
+        cerr << path << ": \"" << member.first->second << "\" and \""
+             << entry.name << "\" would both be named "
+             << entry.identifier << '\n';
+        exit(1);
+      }
+    }
+  }
+
+  // Built in options come after the spec's so indices stay stable
+  if (spec.enable_help) {
+    spec.options.push_back(Entry{kind::help, "", "help", 'h', "", "",
+                                 "Show this help message and exit", ""});
+  }
+  if (!spec.version.empty()) {
+    spec.options.push_back(Entry{kind::version, "", "version", '\0', "", "",
+                                 "Show the version and exit", ""});
+  }
+  return spec;
+}
+
+// Adds `entry` to `parser` as it would appear in usage and help. Values are
+// all strings, since rendering only needs their names.
+template <typename P>
+void add_entry(P& parser, const Spec& spec, const Entry& entry) {
+  switch (entry.type) {
+    case kind::flag:
+      parser.template add_flag<bool>(entry.name, entry.short_name, true)
+          .help(entry.help);
+      break;
+    case kind::option:
+      parser.template add_optargument<>(entry.name, entry.short_name)
+          .help(entry.help);
+      break;
+    case kind::argument:
+      parser.template add_argument<>(entry.name).help(entry.help);
+      break;
+    case kind::varargument:
+      parser.template add_varargument<>(entry.name).help(entry.help);
+      break;
+    case kind::version:
+      parser.add_version(spec.version);
+      break;
+    case kind::help:
+      break;  // Added by the constructor
+  }
+}
+
+// How `entry` appears in usage, rendered on its own without wrapping
+string usage_item(const Spec& spec, const Entry& entry) {
+  BasicParser<PlainHelp> parser("", entry.type == kind::help);
+  parser.set_program_name("-");
+  add_entry(parser, spec, entry);
+  ostringstream buffer;
+  buffer << parser.usage();
+  string line = buffer.str();
+  return line.substr(9, line.size() - 10);  // Between "usage: - " and '\n'
+}
+
+// Renders usage and help with the runtime parser so they match exactly. The
+// program is named "-" unless the spec names it, and `items` are the words
+// usage wraps, in order, so it can be rendered again for argv[0].
+void render(const Spec& spec, string& usage, string& help,
+            vector<string>& items) {
+  Parser parser(spec.description, spec.enable_help);
+  parser.set_program_name(spec.program.empty() ? "-" : spec.program);
+  for (const auto* entries : {&spec.options, &spec.arguments}) {
+    for (const auto& entry : *entries) {
+      add_entry(parser, spec, entry);
+    }
+  }
+
+  ostringstream buffer;
+  buffer << parser.usage();
+  usage = buffer.str();
+  buffer.str("");
+  buffer << parser.help();
+  help = buffer.str();
+
+  // Options are sorted in usage, so order them by where they were rendered
+  string line = usage;
+  replace(line.begin(), line.end(), '\n', ' ');
+  vector<pair<size_t, string>> options;
+  for (const auto& entry : spec.options) {
+    string item = usage_item(spec, entry);
+    options.emplace_back(line.find(' ' + item + ' '), item);
+  }
+  sort(options.begin(), options.end());
+  items.clear();
+  for (const auto& option : options) {
+    items.push_back(option.second);
+  }
+  for (const auto& entry : spec.arguments) {
+    items.push_back(usage_item(spec, entry));
+  }
+}
+
+// A string literal, split into one literal per line
+string quote(const string& text) {
+  ostringstream os;
+  os << '"';
+  for (size_t i = 0; i < text.size(); i++) {
+    char c = text[i];
+    switch (c) {
+      case '"':
+        os << "\\\"";
+        break;
+      case '\\':
+        os << "\\\\";
+        break;
+      case '\n':
+        os << (i + 1 < text.size() ? "\\n\"\n    \"" : "\\n");
+        break;
+      default:
+        os << c;
+    }
+  }
+  os << '"';
+  return os.str();
+}
+
+// Emits `blob` as a static array named blob, twelve bytes to a line
+void emit_blob(ostream& os, const string& blob) {
+  os << "    static const unsigned char blob[] = {";
+  for (size_t i = 0; i < blob.size(); i++) {
+    static const char digits[] = "0123456789abcdef";
+    unsigned char byte = static_cast<unsigned char>(blob[i]);
+    os << (i % 12 ? " " : "\n        ") << "0x" << digits[byte >> 4]
+       << digits[byte & 0xf] << (i + 1 < blob.size() ? "," : "");
+  }
+  os << "};\n";
+}
+
+// Emits a nested switch over the characters of the names in [begin, end), which
+// all share their first `depth` characters
+void emit_matcher(ostream& os, const vector<pair<string, size_t>>& names,
+                  size_t begin, size_t end, size_t depth, unsigned indent) {
+  string pad(indent, ' ');
+  if (end - begin == 1) {
+    // Only one candidate left, so compare the rest in one go
+    os << pad << "return std::strcmp(name + " << depth << ", "
+       << quote(names[begin].first.substr(depth)) << ") ? -1 : "
+       << names[begin].second << ";\n";
+    return;
+  }
+
+  os << pad << "switch (name[" << depth << "]) {\n";
+  while (begin < end) {
+    char c = depth < names[begin].first.size() ? names[begin].first[depth] : 0;
+    size_t stop = begin;
+    while (stop < end &&
+           (depth < names[stop].first.size() ? names[stop].first[depth] : 0) ==
+               c) {
+      stop++;
+    }
+    if (c) {
+      os << pad << "  case '" << (c == '\'' || c == '\\' ? "\\" : "") << c
+         << "':\n";
+      emit_matcher(os, names, begin, stop, depth + 1, indent + 4);
+    } else {
+      os << pad << "  case '\\0':\n" << pad << "    return "
+         << names[begin].second << ";\n";
+    }
+    begin = stop;
+  }
+  os << pad << "}\n" << pad << "return -1;\n";
+}
+
+void emit(ostream& os, const Spec& spec, const string& source) {
+  string usage, help;
+  vector<string> items;
+  render(spec, usage, help, items);
+
+  string guard(spec.class_name);
+  transform(guard.begin(), guard.end(), guard.begin(), ::toupper);
+  guard += "_GENERATED_HXX";
+
+  os << "// Generated by cpparse_gen from " << source << ", do not edit\n"
+     << "#ifndef " << guard << "\n#define " << guard << "\n\n"
+     << "#include <cstdio>\n#include <cstdlib>\n#include <cstring>\n"
+     << "#include <stdexcept>\n#include <string>\n#include <typeinfo>\n"
+     << "#include <vector>\n#include \"cpparse.hxx\"\n\n";
+
+  // Shared between every generated header
+  os << "#ifndef CPPARSE_GENERATED_VALUE\n#define CPPARSE_GENERATED_VALUE\n"
+     << "namespace cpparse {\n"
+     << "// The value of a generated option, read the same way as a Flag or\n"
+     << "// Argument\n"
+     << "template <typename T>\nclass GeneratedValue {\n"
+     << "  T value;\n\n public:\n"
+     << "  explicit GeneratedValue(const T& def) : value(def) {}\n"
+     << "  void set(const T& new_value) { value = new_value; }\n"
+     << "  const T& get() const { return value; }\n};\n}\n#endif\n\n";
+
+  os << "class " << spec.class_name << " {\n public:\n";
+  for (const auto& entry : spec.options) {
+    if (entry.type == kind::flag || entry.type == kind::option) {
+      os << "  cpparse::GeneratedValue<" << entry.cpp_type << "> "
+         << entry.identifier << "{" << entry.cpp_type << "(" << entry.def
+         << ")};\n";
+    }
+  }
+  for (const auto& entry : spec.arguments) {
+    string type = entry.type == kind::argument
+                      ? entry.cpp_type
+                      : "std::vector<" + entry.cpp_type + ">";
+    os << "  cpparse::GeneratedValue<" << type << "> " << entry.identifier
+       << "{" << type << "()};\n";
+  }
+
+  if (spec.program.empty()) {
+    // Only the usage line depends on the program name, so it's wrapped when
+    // printed and the rest of help stays pre-rendered
+    help.erase(0, usage.size());
+    os << "\n  // The name shown in usage, set from argv[0] by parse. Set it by hand\n"
+       << "  // to print usage or help before parsing, e.g. for cpparse::prescan\n"
+       << "  static std::string& program_name() {\n"
+       << "    static std::string name;\n    return name;\n  }\n\n"
+       << "  // Usage and help, valid until either is called again\n"
+       << "  static const char* usage() {\n"
+       << "    static const char* const items[] = {";
+    for (size_t i = 0; i < items.size(); i++) {
+      os << "\n        " << quote(items[i]) << (i + 1 < items.size() ? "," : "");
+    }
+    os << "};\n"
+       << "    static std::string text;\n"
+       << "    std::size_t padding = program_name().size() + 8, width = 80;\n"
+       << "    text = \"usage: \" + program_name();\n"
+       << "    if (padding + 4 >= width) {\n"
+       << "      padding = 24;\n"
+       << "      text += '\\n' + std::string(padding, ' ');\n"
+       << "    } else {\n      text += ' ';\n    }\n"
+       << "    std::size_t column = padding;\n"
+       << "    for (const char* item : items) {\n"
+       << "      std::size_t size = std::strlen(item);\n"
+       << "      if (column > padding && column + size + 1 >= width) {\n"
+       << "        text += '\\n' + std::string(padding, ' ');\n"
+       << "        column = padding;\n      }\n"
+       << "      if (column > padding) {\n"
+       << "        text += ' ';\n        column++;\n      }\n"
+       << "      text += item;\n      column += size;\n    }\n"
+       << "    text += '\\n';\n    return text.c_str();\n  }\n";
+  } else {
+    os << "\n  // Pre-rendered usage and help, also suitable for cpparse::prescan\n"
+       << "  static const char* usage() {\n    return " << quote(usage)
+       << ";\n  }\n";
+  }
+
+  // Help after the usage line, if that's wrapped when printed
+  string help_text = spec.program.empty() ? "rest" : "text";
+  if (spec.compressed_help) {
+    os << "  static const char* help() {\n";
+    emit_blob(os, compress_help({help}));
+    os << "    static const std::string " << help_text << " =\n"
+       << "        cpparse::expand_help(blob, sizeof(blob))[0];\n";
+  } else {
+    os << "  static const char* help() {\n    static const std::string "
+       << help_text << " = " << quote(help) << ";\n";
+  }
+  if (spec.program.empty()) {
+    os << "    static std::string text;\n"
+       << "    text = usage() + rest;\n";
+  }
+  os << "    return text.c_str();\n  }\n\n";
+
+  // Parsing mirrors Parser::parse token for token
+  os << "  void parse(int argc, char** argv) {\n";
+  if (spec.program.empty()) {
+    os << "    if (argc > 0 && program_name().empty()) {\n"
+       << "      program_name() = argv[0];\n    }\n";
+  }
+  bool variadic = !spec.arguments.empty() &&
+                  spec.arguments.back().type == kind::varargument;
+  if (variadic) {
+    const auto& entry = spec.arguments.back();
+    os << "    " << entry.identifier << ".set(std::vector<" << entry.cpp_type
+       << ">());  // Appended to by every positional\n";
+  }
+  os << "    bool process_options = true;\n"
+     << "    std::size_t position = 0;  // Next positional argument\n"
+     << "    for (int i = 1; i < argc; i++) {\n"
+     << "      const char* token = argv[i];\n"
+     << "      if (process_options && token[0] == '-' && token[1] == '-' &&\n"
+     << "          !token[2]) {\n"
+     << "        process_options = false;\n"
+     << "      } else if (process_options && token[0] == '-' && token[1] &&\n"
+     << "                 token[1] != '-') {\n"
+     << "        for (const char* c = token + 1; *c; c++) {\n"
+     << "          int index = *c & 0x80 ? -1 : short_table()[int(*c)];\n"
+     << "          if (index < 0) {\n"
+     << "            not_found(\"Short\", std::string(1, *c));\n"
+     << "          } else if (apply(index, c + 1, argc, argv, i, "
+        "process_options)) {\n"
+     << "            break;  // The rest was its argument\n"
+     << "          }\n"
+     << "        }\n"
+     << "      } else if (process_options && token[0] == '-' && token[1] == "
+        "'-') {\n"
+     << "        int index = find_long(token + 2);\n"
+     << "        if (index < 0) {\n"
+     << "          not_found(\"Long\", token + 2);\n"
+     << "        }\n"
+     << "        apply(index, \"\", argc, argv, i, process_options);\n"
+     << "      } else {\n";
+  if (variadic) {
+    // Like Parser, the variadic argument takes the values after options too
+    os << "        positional(position, argc, argv, i, process_options);\n";
+    if (spec.arguments.size() > 1) {
+      os << "        position += position < " << spec.arguments.size() - 1
+         << ";\n";
+    }
+  } else {
+    os << "        positional(position++, argc, argv, i, process_options);\n";
+  }
+  os << "      }\n"
+     << "    }\n"
+     << "    for (int i = argc; position < " << spec.arguments.size()
+     << "; position++) {\n"
+     << "      positional(position, argc, argv, i, process_options);\n"
+     << "    }\n"
+     << "  }\n\n private:\n";
+
+  // Long option matcher
+  vector<pair<string, size_t>> names;
+  for (size_t i = 0; i < spec.options.size(); i++) {
+    names.emplace_back(spec.options[i].name, i);
+  }
+  sort(names.begin(), names.end());
+  os << "  // Index of the long option `name`, or -1\n"
+     << "  static int find_long(const char* name) {\n";
+  if (names.empty()) {
+    os << "    (void)name;\n    return -1;\n";
+  } else {
+    emit_matcher(os, names, 0, names.size(), 0, 4);
+  }
+  os << "  }\n\n";
+
+  // Short option table
+  vector<int> table(128, -1);
+  for (size_t i = 0; i < spec.options.size(); i++) {
+    if (spec.options[i].short_name) {
+      table[int(spec.options[i].short_name)] = int(i);
+    }
+  }
+  os << "  // Index of each short option, or -1\n"
+     << "  static const signed char* short_table() {\n"
+     << "    static const signed char table[128] = {";
+  for (size_t i = 0; i < table.size(); i++) {
+    os << (i % 16 ? " " : "\n        ") << table[i]
+       << (i + 1 < table.size() ? "," : "");
+  }
+  os << "};\n    return table;\n  }\n\n";
+
+  // Errors match ArgReader
+  os << "  [[noreturn]] static void usage_exit() {\n"
+     << "    std::fputs(usage(), stderr);\n    std::exit(1);\n  }\n\n"
+     << "  [[noreturn]] static void not_found(const char* type, const std::string& "
+        "option) {\n"
+     << "    std::fprintf(stderr, \"%s option \\\"%s\\\" is not a valid "
+        "option\\n\", type,\n"
+     << "                 option.c_str());\n"
+     << "    usage_exit();\n  }\n\n"
+     << "  [[noreturn]] static void too_many(const char* argument) {\n"
+     << "    std::fprintf(stderr,\n"
+     << "                 \"Argument \\\"%s\\\" specified, but program demands "
+        "no more \"\n"
+     << "                 \"arguments\\n\",\n"
+     << "                 argument);\n"
+     << "    usage_exit();\n  }\n\n"
+     << "  [[noreturn]] static void required(const char* name) {\n"
+     << "    std::fprintf(stderr,\n"
+     << "                 \"'%s' requires an argument, but none was "
+        "specified\\n\", name);\n"
+     << "    usage_exit();\n  }\n\n"
+     << "  template <typename T>\n"
+     << "  static T convert(const char* name, const char* input) {\n"
+     << "#ifdef CPPARSE_NO_EXCEPTIONS\n"
+     << "    T value;\n"
+     << "    if (cpparse::read<T>(input, value)) {\n"
+     << "      return value;\n    }\n"
+     << "#else\n"
+     << "    try {\n      return cpparse::read<T>(input);\n"
+     << "    } catch (const std::invalid_argument&) {\n    }\n"
+     << "#endif\n"
+     << "    std::fprintf(stderr,\n"
+     << "                 \"Parse error trying to interpret '%s' argument "
+        "\\\"%s\\\" as \"\n"
+     << "                 \"an '%s'\\n\",\n"
+     << "                 name, input, cpparse::type_name<T>());\n"
+     << "    usage_exit();\n  }\n\n"
+     << "  // The argument of an option, `attached` to a short option or the "
+        "next token\n"
+     << "  static const char* argument(const char* name, const char* "
+        "attached, int argc,\n"
+     << "                              char** argv, int& i, bool "
+        "process_options) {\n"
+     << "    if (*attached) {\n      return attached;\n"
+     << "    } else if (i + 1 < argc && !(process_options && argv[i + 1][0] "
+        "== '-')) {\n"
+     << "      return argv[++i];\n    }\n"
+     << "    required(name);\n  }\n\n";
+
+  // Option actions
+  os << "  // Returns whether `attached` was used as the option's argument\n"
+     << "  bool apply(int index, const char* attached, int argc, char** argv,\n"
+     << "             int& i, bool process_options) {\n"
+     << "    switch (index) {\n";
+  for (size_t i = 0; i < spec.options.size(); i++) {
+    const auto& entry = spec.options[i];
+    os << "      case " << i << ":\n";
+    switch (entry.type) {
+      case kind::flag:
+        os << "        " << entry.identifier << ".set(" << entry.cpp_type
+           << "(" << entry.constant << "));\n        return false;\n";
+        break;
+      case kind::option:
+        os << "        " << entry.identifier << ".set(convert<"
+           << entry.cpp_type << ">(\n            " << quote(entry.name)
+           << ", argument(" << quote(entry.name)
+           << ", attached, argc, argv, i, process_options)));\n"
+           << "        return true;\n";
+        break;
+      case kind::help:
+        os << "        std::fputs(help(), stdout);\n"
+           << "        std::exit(0);\n";
+        break;
+      case kind::version:
+        os << "        std::puts(" << quote(spec.version) << ");\n"
+           << "        std::exit(0);\n";
+        break;
+      default:
+        break;
+    }
+  }
+  os << "      default:\n        (void)attached;\n        (void)argc;\n"
+     << "        (void)argv;\n        (void)i;\n        (void)process_options;\n"
+     << "        return false;\n    }\n  }\n\n";
+
+  // Positional arguments
+  os << "  void positional(std::size_t position, int argc, char** argv, int& "
+        "i,\n"
+     << "                  bool process_options) {\n"
+     << "    bool given = i < argc && !(process_options && argv[i][0] == "
+        "'-');\n"
+     << "    switch (position) {\n";
+  for (size_t i = 0; i < spec.arguments.size(); i++) {
+    const auto& entry = spec.arguments[i];
+    if (entry.type == kind::argument) {
+      os << "      case " << i << ":\n"
+         << "        if (!given) {\n          required(" << quote(entry.name)
+         << ");\n        }\n"
+         << "        " << entry.identifier << ".set(convert<"
+         << entry.cpp_type << ">(" << quote(entry.name) << ", argv[i]));\n"
+         << "        return;\n";
+    } else {
+      // Takes every token up to the next option, adding to those before it
+      os << "      case " << i << ": {\n        std::vector<" << entry.cpp_type
+         << "> values = " << entry.identifier << ".get();\n"
+         << "        if (!given && i < argc) {\n"
+         << "          too_many(argv[i]);  // Same as Parser for a lone -\n"
+         << "        }\n"
+         << "        while (given) {\n"
+         << "          values.push_back(convert<" << entry.cpp_type << ">("
+         << quote(entry.name) << ", argv[i]));\n"
+         << "          given = i + 1 < argc &&\n"
+         << "                  !(process_options && argv[i + 1][0] == '-');\n"
+         << "          i += given;\n"
+         << "        }\n"
+         << "        " << entry.identifier << ".set(values);\n"
+         << "        return;\n      }\n";
+    }
+  }
+  os << "      default:\n"
+     << "        too_many(argv[i]);\n    }\n  }\n};\n\n#endif\n";
+}
+
+int main(int argc, char** argv) {
+  Parser parser(
+      "Generate a header with a parser specialized to a declarative spec. See "
+      "cpparse_gen.cxx for the spec format.");
+  auto& spec_path = parser.add_argument<>("spec").help("Spec file to read");
+  auto& output = parser.add_optargument<>("output", 'o').help(
+      "Header to write, standard out if unspecified");
+  parser.parse(argc, argv);
+
+  Spec spec = read_spec(spec_path.get());
+  if (output.get().empty()) {
+    emit(cout, spec, spec_path.get());
+  } else {
+    ofstream file(output.get());
+    emit(file, spec, spec_path.get());
+    if (!file) {
+      cerr << "Couldn't write \"" << output.get() << "\"\n";
+      return 1;
+    }
+  }
+}
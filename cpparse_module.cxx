@@ -0,0 +1,37 @@
+// C++20 module interface for cpparse. The library itself stays C++14; this
+// unit exports the declarations from cpparse.hxx and cpparse_parser.hxx, and
+// relies on libcpparse.a for the definitions.
+module;
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+export module cpparse;
+
+export extern "C++" {
+#include "cpparse.hxx"
+#include "cpparse_parser.hxx"
+}
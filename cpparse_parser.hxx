@@ -0,0 +1,658 @@
+#ifndef CPPARSE_PARSER_HXX
+#define CPPARSE_PARSER_HXX
+
+// The policy dependent parts of BasicParser. Included by cpparse.hxx unless
+// the library is compiled separately, which only has the default policies, so
+// with CPPARSE_LIBRARY a parser with other policies needs this too.
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cpparse.hxx"
+
+namespace cpparse {
+// -----------
+// Hashed Maps
+// -----------
+template <typename Key, typename Value, typename Alloc>
+class HashedMap : public std::unordered_map<Key, Value, std::hash<Key>,
+                                            std::equal_to<Key>, Alloc> {};
+
+// ---------------
+// Argument Reader
+// ---------------
+// This is a class to make argument parsing a lot easier by abstracting away
+// difference between long and short options as well as handling the -- marker
+// for the end of arguments. This also provides convenience methods for
+// throwing parsing errors.
+
+// Option types for parsing
+// The ArgReader will return these to indicate what type of option was parsed
+enum class ot { end, argument, short_opt, long_opt, marker };
+
+// How one argv token is written to a capture corpus
+struct CapturedToken {
+  Capture mode;
+  std::size_t offset;  // Where the value starts, after a bundled short option
+};
+
+// Actual ArgReader
+struct ArgReader {
+  char** const args;
+  char** itr;
+  char* const* end;
+  bool process_options;
+  std::string current;
+  std::string::iterator location;  // Current location in `current`
+  std::vector<Option*> pending;     // Options converting in the background
+
+  // Where errors go, see BasicParser::report
+  void (*reporter)(void* parser, const ParseError& error);
+  void* parser;
+  bool failed;  // Whether an error was reported, parsing stops if so
+  ParseStats* stats;  // Null unless the parser collects statistics
+  // Per argv token, empty unless capturing
+  std::vector<CapturedToken> captured;
+  std::size_t value_offset;  // Where next_argument's value starts in its token
+  std::vector<std::uint64_t> seen;  // Bit per id of every option given
+
+  ArgReader(void (*reporter)(void*, const ParseError&), void* parser, int argc,
+            char** argv);
+
+  // Grabs the next `flag` from argv. If flag is an empty argument, then
+  // location is reset so that next_argument does the right thing. Returns an
+  // enum indicating the type of flag it grabbed.
+  ot next_flag(std::string& buffer);
+
+  // Get the next argument. Fails if next argument can't be found (due to
+  // having a flag next or being at the end)
+  bool next_argument(std::string& buffer);
+
+  // Drop the rest of the current token, e.g. the remaining characters of a
+  // short option bundle
+  void skip_token() { location = current.end(); }
+
+  // Capture the value next_argument last read as `mode`
+  void capture(Capture mode);
+
+  // Record that the option with id `id` was given
+  void mark_seen(std::size_t id);
+  bool was_seen(std::size_t id) const;
+
+  // Helpful error messages for parsing. These are here so that arguments can
+  // report errors without access to the parser.
+  void report(const ParseError& error);
+
+  void option_not_found(const char* type, const std::string& option);
+
+  void too_many_args(const std::string& argument);
+
+  template <typename T>
+  void parse_error(const std::string& name, const std::string& argument) {
+    parse_error(name, argument, type_name<T>());
+  }
+
+  void parse_error(const std::string& name, const std::string& argument,
+                   const char* type);
+
+  void required_argument(const std::string& name);
+
+  void mismatched_pattern(const std::string& name, const std::string& argument,
+                          const Pattern& pattern);
+};
+
+// Charges time to `phase` of `stats` until it's destroyed, then back to the
+// phase before it, so that nested phases aren't counted twice. Does nothing
+// without stats.
+class PhaseTimer {
+  ParseStats* const stats;
+  ParseStats::Duration ParseStats::*previous;
+
+ public:
+  PhaseTimer(ParseStats* stats, ParseStats::Duration ParseStats::*phase);
+  ~PhaseTimer();
+
+  PhaseTimer(const PhaseTimer&) = delete;
+  PhaseTimer& operator=(const PhaseTimer&) = delete;
+};
+
+// Adds the counts, times and conversions of `from` to `into`, e.g. those of
+// parse_async's background join
+void merge_stats(ParseStats& into, const ParseStats& from);
+
+// ----------------
+// Parser Functions
+// ----------------
+// Everything that doesn't depend on the policies is compiled with the rest of
+// the library, behind these functions
+
+// Options every parser can add
+Option* help_flag(const std::function<void(std::ostream&)>& print_help);
+Option* version_flag(const std::string& version);
+
+// Calls `enroll` with an option for every CPPARSE_FLAG and CPPARSE_OPTION
+void descriptor_options(const std::function<void(Option*)>& enroll);
+
+// Calls `add` with the path and option names of every plugin in `manifest`
+void read_manifest(const std::string& manifest,
+                   const std::function<void(const std::string& path,
+                                            const std::vector<std::string>&
+                                                names)>& add);
+
+// Loads the plugin at `path`, returning its `cpparse_register`
+void* open_plugin(const std::string& path, void*& handle);
+
+// Appends argv to the corpus at `path`, with each token written as `tokens`
+// says, see BasicParser::capture
+void append_corpus(const std::string& path, int argc, char** argv,
+                   const std::vector<CapturedToken>& tokens);
+
+// Calls `set` with every setting in the config file at `path`, see
+// BasicParser::reload
+bool read_config(
+    const std::string& path,
+    const std::function<bool(const std::string& name,
+                             const std::string& value)>& set);
+
+// A group of `members`, failing if it can never be satisfied or is empty
+ConstraintGroup make_group(Group kind, const std::vector<Option*>& members);
+
+// Reports the first of `count` groups that the options `reader` saw break
+void check_groups(ArgReader& reader, const ConstraintGroup* groups,
+                  std::size_t count);
+
+// Orders options by namespace, with names outside any namespace first, and
+// then by name
+bool namespace_less(const Option* a, const Option* b);
+
+template <typename... Policies>
+BasicParser<Policies...>::BasicParser(const std::string& description_,
+                                      bool enable_help)
+    : variadic(false),
+      help_option(nullptr),
+      required{Group::required, {}, {}},
+      description(description_),
+      sink(),
+      help_data(nullptr),
+      help_size(0),
+      collecting(false),
+      count_allocations(nullptr),
+      statistics() {
+  if (enable_help) {
+    help_option = help_flag([this](std::ostream& os) {
+      load_plugins();  // Full help includes every plugin
+      os << help();
+    });
+    enroll_option(help_option);
+  }
+  descriptor_options([this](Option* option) { enroll_option(option); });
+}
+
+// Parsing function works in tandem with ArgReader
+template <typename... Policies>
+bool BasicParser<Policies...>::parse(int argc, char** argv) {
+  return parse_all(argc, argv, true);
+}
+
+template <typename... Policies>
+bool BasicParser<Policies...>::parse_known(int argc, char** argv) {
+  return parse_all(argc, argv, false);
+}
+
+// parse, or parse_known unless `strict`
+template <typename... Policies>
+bool BasicParser<Policies...>::parse_all(int argc, char** argv, bool strict) {
+  ArgReader reader(report, this, argc, argv);
+  reader.stats = begin_stats();
+  if (!capture_path.empty()) {
+    reader.captured.assign(argc, CapturedToken{Capture::keep, 0});
+  }
+  parse_tokens(reader, argc, argv, strict);
+  join_pending(reader);
+  end_stats();
+  if (!capture_path.empty()) {
+    append_corpus(capture_path, argc, argv, reader.captured);
+  }
+  return !reader.failed;
+}
+
+template <typename... Policies>
+Task BasicParser<Policies...>::parse_async(int argc, char** argv) {
+  // The reader must outlive this call so that the background conversions can
+  // still report errors through it
+  auto reader = std::make_shared<ArgReader>(report, this, argc, argv);
+  reader->stats = begin_stats();
+  if (!capture_path.empty()) {
+    reader->captured.assign(argc, CapturedToken{Capture::keep, 0});
+  }
+  parse_tokens(*reader, argc, argv, true);
+  end_stats();
+  if (!capture_path.empty()) {
+    append_corpus(capture_path, argc, argv, reader->captured);
+  }
+  // Errors from the background are only kept there, and reported by whichever
+  // thread waits for the task, since the sink may well exit. Likewise its
+  // statistics, since the caller may time formatting meanwhile.
+  std::shared_ptr<ParseStats> background;
+  if (reader->stats) {
+    background = std::make_shared<ParseStats>();
+    reader->stats = background.get();
+  }
+  auto kept = std::make_shared<FirstErrorSink>();
+  reader->parser = kept.get();
+  reader->reporter = [](void* sink, const ParseError& error) {
+    static_cast<FirstErrorSink*>(sink)->report(error,
+                                               UsageFormatter(nullptr, nullptr));
+  };
+  Task done(
+      [reader, kept, background]() {
+        join_pending(*reader);
+        return !reader->failed;
+      },
+      [this, kept, background](bool succeeded) {
+        if (background) {
+          merge_stats(statistics, *background);
+        }
+        if (kept->failed) {
+          report(this, kept->error);
+        }
+        return succeeded;
+      });
+  for (auto* option : reader->pending) {
+    option->parsed = done;
+  }
+  return done;
+}
+
+// Reads every token, converting or dispatching values as it goes, until an
+// error is reported. Unless strict, tokens that don't belong to this parser are
+// skipped, and so is help.
+template <typename... Policies>
+void BasicParser<Policies...>::parse_tokens(ArgReader& reader, int argc,
+                                            char** argv, bool strict) {
+  CPPARSE_PROBE(parse__start, argc);
+  if (argc > 0 && !program_name.size()) {  // Assign program name
+    program_name = *argv;
+  }
+
+  sink = ErrorSink();  // Errors are only kept from the latest parse
+  reader.seen.assign((options.size() + 63) / 64, 0);
+  // An index, since a plugin loaded mid parse can add positionals
+  std::size_t next_argument = 0;
+  std::string flag;
+  ot type;
+  PhaseTimer dispatch(reader.stats, &ParseStats::dispatch);
+  while (!reader.failed && (type = reader.next_flag(flag)) != ot::end) {
+    CPPARSE_PROBE(token, static_cast<int>(type), flag.size());
+    if (reader.stats) {
+      reader.stats->tokens[static_cast<int>(type)]++;
+    }
+    switch (type) {
+      case ot::short_opt: {
+        auto option = short_options.find(flag[0]);
+        std::size_t lookups = 1;
+        if (option == short_options.end() && !plugin_short_options.empty()) {
+          auto plugin = plugin_short_options.find(flag[0]);
+          lookups++;
+          if (plugin != plugin_short_options.end()) {
+            load_plugin(plugin->second);
+            option = short_options.find(flag[0]);
+            lookups++;
+          }
+        }
+        if (reader.stats) {
+          reader.stats->lookups += lookups;
+        }
+        bool known = option != short_options.end() &&
+                     (strict || option->second != help_option);
+        if (!known && !strict) {
+          reader.skip_token();  // The rest could be its argument
+        } else if (!known) {
+          reader.option_not_found("Short", flag);
+        } else {
+          option->second->parse(reader);
+          reader.mark_seen(option->second->id);
+        }
+        break;
+      }
+      case ot::long_opt: {
+        auto* option = find_option(flag);
+        std::size_t lookups = 1;
+        if (!option && !plugin_options.empty()) {
+          auto plugin = plugin_options.find(flag);
+          lookups++;
+          if (plugin != plugin_options.end()) {
+            load_plugin(plugin->second);
+            option = find_option(flag);
+            lookups++;
+          }
+        }
+        if (reader.stats) {
+          reader.stats->lookups += lookups;
+        }
+        if (!strict && option == help_option) {
+          option = nullptr;  // Left for the full parser
+        }
+        if (!option && strict) {
+          reader.option_not_found("Long", flag);
+        } else if (option) {
+          option->parse(reader);
+          reader.mark_seen(option->id);
+        }
+        break;
+      }
+      case ot::argument: {
+        bool extra = next_argument == arguments.size();
+        if (extra && variadic) {
+          arguments.back()->parse(reader);  // More values after an option
+        } else if (extra && !strict) {
+          reader.next_argument(flag);  // Consume it
+        } else if (extra) {
+          reader.too_many_args(flag);
+        } else {
+          arguments[next_argument++]->parse(reader);
+        }
+        break;
+      }
+      case ot::marker: {
+        break;
+      }
+      case ot::end: {
+        fail<std::logic_error>("Should never reach here");
+      }
+    }
+  }
+  PhaseTimer validate(reader.stats, &ParseStats::validate);
+  while (!reader.failed && next_argument < arguments.size()) {
+    arguments[next_argument++]->parse(reader);
+  }
+  if (variadic) {
+    arguments.back()->join(reader);
+  }
+  if (!reader.failed) {
+    check_groups(reader, &required, 1);
+  }
+  if (!reader.failed) {
+    check_groups(reader, groups.data(), groups.size());
+  }
+}
+
+// Errors from expensive converters are reported in the order the options were
+// given, regardless of which conversion finished first
+template <typename... Policies>
+void BasicParser<Policies...>::join_pending(ArgReader& reader) {
+  PhaseTimer validate(reader.stats, &ParseStats::validate);
+  for (auto* option : reader.pending) {
+    if (reader.failed) {
+      break;
+    }
+    option->join(reader);
+  }
+  CPPARSE_PROBE(parse__end, reader.failed);
+}
+
+// This is the method to add an option agnostic to everything else
+template <typename... Policies>
+void BasicParser<Policies...>::enroll_option(Option* option) {
+  if (options.find(option->name) != options.end()) {
+    fail<std::invalid_argument>(
+        std::string("Can't add two options with the same name: \"") +
+        option->name + '"');
+  }
+  if (option->short_name &&
+      short_options.find(option->short_name) != short_options.end()) {
+    fail<std::invalid_argument>(
+        std::string("Can't add two options with the same short name: '") +
+        option->short_name + '\'');
+  }
+  if (option->name.find('.') != std::string::npos &&
+      !namespaces.insert(option->name, option)) {
+    fail<std::invalid_argument>(
+        std::string("Option namespaces can't be empty: \"") + option->name +
+        '"');
+  }
+  option->id = options.size();
+  options[option->name] = std::unique_ptr<Option>(option);
+  if (option->short_name) {
+    short_options[option->short_name] = option;
+  }
+}
+
+// Dotted names go through the trie, the rest through the lookup policy
+template <typename... Policies>
+Option* BasicParser<Policies...>::find_option(const std::string& name) {
+  if (name.find('.') != std::string::npos) {
+    return namespaces.find(name);
+  }
+  auto option = options.find(name);
+  return option == options.end() ? nullptr : option->second.get();
+}
+
+// Every required option is kept in one group, so one mask covers them all
+template <typename... Policies>
+void BasicParser<Policies...>::require(const std::vector<std::string>& names) {
+  auto members = required.members;
+  for (const auto& name : names) {
+    auto* option = find_option(name);
+    if (!option) {
+      fail<std::invalid_argument>(
+          std::string("Can't require an option that doesn't exist: \"") +
+          name + '"');
+    }
+    option->required = true;
+    members.push_back(option);
+  }
+  required = make_group(Group::required, members);
+}
+
+template <typename... Policies>
+void BasicParser<Policies...>::add_group(
+    Group kind, const std::vector<std::string>& names) {
+  std::vector<Option*> members;
+  for (const auto& name : names) {
+    auto* option = find_option(name);
+    if (!option) {
+      fail<std::invalid_argument>(
+          std::string("Can't group an option that doesn't exist: \"") + name +
+          '"');
+    }
+    members.push_back(option);
+  }
+  groups.push_back(make_group(kind, members));
+}
+
+template <typename... Policies>
+void BasicParser<Policies...>::help_blob(const unsigned char* blob,
+                                         std::size_t size) {
+  help_data = blob;
+  help_size = size;
+}
+
+template <typename... Policies>
+void BasicParser<Policies...>::set_program_name(const std::string& name) {
+  program_name = name;
+}
+
+template <typename... Policies>
+void BasicParser<Policies...>::add_version(const std::string& version) {
+  enroll_option(version_flag(version));
+}
+
+// This is the method to add an argument agnostic to everything else
+template <typename... Policies>
+void BasicParser<Policies...>::enroll_argument(Option* argument) {
+  if (variadic) {
+    fail<std::invalid_argument>(
+        std::string("Can't add an argument after a variable argument: \"") +
+        argument->name + '"');
+  }
+  arguments.push_back(std::unique_ptr<Option>(argument));
+}
+
+template <typename... Policies>
+void BasicParser<Policies...>::add_plugins(const std::string& manifest) {
+  // Plugins are built against PluginRegister, so loading one into a parser
+  // with other policies would call it through the wrong type
+  static_assert(std::is_same<BasicParser, Parser>::value,
+                "Only a Parser can load plugins");
+  read_manifest(manifest, [this](const std::string& path,
+                                 const std::vector<std::string>& names) {
+    for (const auto& name : names) {
+      if (name.size() == 1) {
+        plugin_short_options[name[0]] = plugins.size();
+      } else {
+        plugin_options[name] = plugins.size();
+      }
+    }
+    plugins.push_back(Plugin{path, nullptr});
+  });
+}
+
+template <typename... Policies>
+void BasicParser<Policies...>::load_plugins() {
+  for (std::size_t i = 0; i < plugins.size(); i++) {
+    load_plugin(i);
+  }
+}
+
+// Plugins stay loaded for the life of the process, since the options they
+// register run their code. Only a Parser gets this far, see add_plugins.
+template <typename... Policies>
+void BasicParser<Policies...>::load_plugin(std::size_t index) {
+  Plugin& plugin = plugins[index];
+  if (plugin.handle) {
+    return;
+  }
+  auto enroll = reinterpret_cast<void (*)(BasicParser&)>(
+      open_plugin(plugin.path, plugin.handle));
+  enroll(*this);
+}
+
+// Reloading only ever touches options that opted into it, since those are the
+// only ones safe to update while other threads read them
+template <typename... Policies>
+bool BasicParser<Policies...>::set(const std::string& name,
+                                   const std::string& value) {
+  auto option = options.find(name);
+  return option != options.end() && option->second->reload(value);
+}
+
+template <typename... Policies>
+bool BasicParser<Policies...>::reload(const std::string& path) {
+  return read_config(path, [this](const std::string& name,
+                                  const std::string& value) {
+    return set(name, value);
+  });
+}
+
+template <typename... Policies>
+const typename BasicParser<Policies...>::ErrorSink&
+BasicParser<Policies...>::errors() const {
+  return sink;
+}
+
+template <typename... Policies>
+void BasicParser<Policies...>::collect_stats(std::size_t (*allocations)()) {
+  collecting = true;
+  count_allocations = allocations;
+}
+
+template <typename... Policies>
+const ParseStats& BasicParser<Policies...>::stats() const {
+  return statistics;
+}
+
+template <typename... Policies>
+void BasicParser<Policies...>::capture(const std::string& path) {
+  capture_path = path;
+}
+
+// Allocations are counted from here to end_stats
+template <typename... Policies>
+ParseStats* BasicParser<Policies...>::begin_stats() {
+  if (!collecting) {
+    return nullptr;
+  }
+  statistics = ParseStats();
+  statistics.allocations = count_allocations ? count_allocations() : 0;
+  return &statistics;
+}
+
+template <typename... Policies>
+void BasicParser<Policies...>::end_stats() {
+  if (collecting && count_allocations) {
+    statistics.allocations = count_allocations() - statistics.allocations;
+  } else {
+    statistics.allocations = 0;
+  }
+}
+
+// Sorted here rather than relying on the lookup, so that hashed lookup prints
+// the same usage and help, and each namespace is printed together
+template <typename... Policies>
+ParserView BasicParser<Policies...>::view() const {
+  ParserView view{program_name, description, {}, {}, {}};
+  for (const auto& option : options) {
+    view.options.push_back(option.second.get());
+  }
+  std::sort(view.options.begin(), view.options.end(), namespace_less);
+  for (const auto& argument : arguments) {
+    view.arguments.push_back(argument.get());
+  }
+  return view;
+}
+
+template <typename... Policies>
+std::ostream& BasicParser<Policies...>::format_usage(std::ostream& os,
+                                                     const void* parser) {
+  auto* self = static_cast<const BasicParser*>(parser);
+  PhaseTimer format(self->collecting ? &self->statistics : nullptr,
+                    &ParseStats::format);
+  auto view = self->view();
+  CPPARSE_PROBE(format__start, 0, view.options.size());
+  Policy::Formatter::usage(os, view);
+  CPPARSE_PROBE(format__end, 0, view.options.size());
+  return os;
+}
+
+template <typename... Policies>
+std::ostream& BasicParser<Policies...>::format_help(std::ostream& os,
+                                                    const void* parser) {
+  auto* self = static_cast<const BasicParser*>(parser);
+  PhaseTimer format(self->collecting ? &self->statistics : nullptr,
+                    &ParseStats::format);
+  auto view = self->view();
+  if (self->help_data) {
+    view.help_entries = expand_help(self->help_data, self->help_size);
+  }
+  CPPARSE_PROBE(format__start, 1, view.options.size());
+  Policy::Formatter::help(os, view);
+  CPPARSE_PROBE(format__end, 1, view.options.size());
+  return os;
+}
+
+template <typename... Policies>
+void BasicParser<Policies...>::report(void* parser, const ParseError& error) {
+  auto* self = static_cast<BasicParser*>(parser);
+  self->sink.report(error, self->usage());
+}
+
+// Get usage formatter
+template <typename... Policies>
+UsageFormatter BasicParser<Policies...>::usage() const {
+  return UsageFormatter(this, format_usage);
+}
+
+// Get help formatter
+template <typename... Policies>
+HelpFormatter BasicParser<Policies...>::help() const {
+  return HelpFormatter(this, format_help);
+}
+}
+
+#endif
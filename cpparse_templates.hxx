@@ -0,0 +1,719 @@
+#ifndef CPPARSE_TEMPLATES_HXX
+#define CPPARSE_TEMPLATES_HXX
+
+// Definitions every includer needs, even when the rest of the library is
+// compiled separately: the option templates and the parser methods that add
+// them. The rest of BasicParser is in cpparse_parser.hxx.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <istream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+#include "cpparse.hxx"
+
+namespace cpparse {
+// ----------------
+// Usage Formatting
+// ----------------
+
+// The parser is type erased so that these work with every BasicParser, and
+// only render when printed
+class UsageFormatter {
+  friend std::ostream& operator<<(std::ostream& os,
+                                  const UsageFormatter& usage) {
+    return usage.format(os, usage.parser);
+  }
+
+  const void* parser;
+  std::ostream& (*format)(std::ostream& os, const void* parser);
+
+ public:
+  UsageFormatter(const void* parser_,
+                 std::ostream& (*format_)(std::ostream&, const void*))
+      : parser(parser_), format(format_) {}
+};
+
+// ---------------
+// Help Formatting
+// ---------------
+class HelpFormatter {
+  friend std::ostream& operator<<(std::ostream& os, const HelpFormatter& help) {
+    return help.format(os, help.parser);
+  }
+
+  const void* parser;
+  std::ostream& (*format)(std::ostream& os, const void* parser);
+
+ public:
+  HelpFormatter(const void* parser_,
+                std::ostream& (*format_)(std::ostream&, const void*))
+      : parser(parser_), format(format_) {}
+};
+
+// ----------
+// Conversion
+// ----------
+// The only places that need to know how converters report failure
+
+// Convert `input` into `output`, false if it couldn't be converted
+template <typename T, typename Convert>
+bool try_convert(const Convert& converter, const std::string& input,
+                 T& output) {
+#ifdef CPPARSE_NO_EXCEPTIONS
+  return converter(input, output);
+#else
+  try {
+    output = converter(input);
+    return true;
+  } catch (const std::invalid_argument&) {
+    return false;
+  }
+#endif
+}
+
+// Convert `input` into a new shared value, null if it couldn't be converted
+template <typename T>
+std::shared_ptr<const T> convert_shared(const Converter<T>& converter,
+                                        const std::string& input) {
+#ifdef CPPARSE_NO_EXCEPTIONS
+  T output;
+  if (!converter(input, output)) {
+    return nullptr;
+  }
+  return std::make_shared<const T>(std::move(output));
+#else
+  try {
+    return std::make_shared<const T>(converter(input));
+  } catch (const std::invalid_argument&) {
+    return nullptr;
+  }
+#endif
+}
+
+// The type in a function signature like
+// "const char* cpparse::type_name() [with T = int]", or "value" if it has none.
+// Kept in a fixed buffer so that FixedParser can use it without allocating.
+struct SignatureType {
+  char text[128];  // Truncated if longer
+
+  explicit SignatureType(const char* signature);
+};
+
+template <typename T>
+const char* type_name() {
+#ifdef __GNUC__
+  static const SignatureType name(__PRETTY_FUNCTION__);
+#else
+  static const SignatureType name(__func__);
+#endif
+  return name.text;
+}
+
+// ------------------
+// Descriptor Options
+// ------------------
+template <typename T>
+bool assign_descriptor(void* storage, const char* input) {
+  return try_convert(read<T>, input, *static_cast<T*>(storage));
+}
+
+// ----
+// Flag
+// ----
+// An option with no arguments.
+template <typename... Policies>
+template <typename T>
+Flag<T>& BasicParser<Policies...>::add_flag(const std::string& name,
+                                            char short_name, T constant,
+                                            T def) {
+  auto* flag = new Flag<T>(name, short_name, constant, def);
+  enroll_option(flag);
+  return *flag;
+}
+
+template <typename... Policies>
+template <typename T>
+Flag<T>& BasicParser<Policies...>::add_flag(const std::string& name,
+                                            T constant, T def) {
+  return add_flag(name, '\0', constant, def);
+}
+
+template <typename T>
+Flag<T>::Flag(const std::string& name, char short_name, const T& constant_,
+              const T& def)
+    : Option(name, short_name), value(def), constant(constant_) {}
+
+template <typename T>
+void Flag<T>::parse(ArgReader& reader) {
+  (void)reader;  // hide unused warning
+  value = constant;
+}
+
+template <typename T>
+Flag<T>& Flag<T>::help(const std::string& new_string) {
+  this->help_text.assign(new_string);
+  return *this;
+}
+
+template <typename T>
+Flag<T>& Flag<T>::help_entry(std::size_t entry) {
+  this->help_index = entry;
+  return *this;
+}
+
+template <typename T>
+const T& Flag<T>::get() const {
+  return value;
+}
+
+// --------
+// Argument
+// --------
+// An option or argument with one argument
+template <typename... Policies>
+template <typename T>
+Argument<T>& BasicParser<Policies...>::add_optargument(
+    const std::string& name, char short_name, T def,
+    const Converter<T> converter) {
+  auto* optarg = new Argument<T>(name, short_name, def, converter);
+  enroll_option(optarg);
+  return *optarg;
+}
+
+template <typename... Policies>
+template <typename T>
+Argument<T>& BasicParser<Policies...>::add_optargument(
+    const std::string& name, T def, const Converter<T> converter) {
+  return add_optargument(name, '\0', def, converter);
+}
+
+template <typename... Policies>
+template <typename T>
+Argument<T>& BasicParser<Policies...>::add_argument(
+    const std::string& name, const Converter<T> converter) {
+  auto* arg = new Argument<T>(name, '\0', T(), converter);
+  enroll_argument(arg);
+  return *arg;
+}
+
+template <typename T>
+Argument<T>::Argument(const std::string& name, char short_name, const T& def,
+                      const Converter<T>& converter_)
+    : SingleOption(name, short_name, cpparse::type_name<T>()),
+      value(def),
+      converter(converter_),
+      cache(),
+      cached() {}
+
+template <typename T>
+bool Argument<T>::store(const std::string& input) {
+  if (!cache) {
+    return try_convert(converter, input, value);
+  }
+  auto result = cache->convert(input);
+  if (!result) {
+    return false;
+  }
+  cached = std::move(result);
+  return true;
+}
+
+template <typename T>
+Argument<T>& Argument<T>::help(const std::string& new_string) {
+  this->help_text.assign(new_string);
+  return *this;
+}
+
+template <typename T>
+Argument<T>& Argument<T>::help_entry(std::size_t entry) {
+  this->help_index = entry;
+  return *this;
+}
+
+template <typename T>
+Argument<T>& Argument<T>::expensive() {
+  this->deferred = true;
+  return *this;
+}
+
+template <typename T>
+Argument<T>& Argument<T>::memoize(std::size_t capacity) {
+  return memoize(std::make_shared<MemoCache<T>>(capacity, converter));
+}
+
+template <typename T>
+Argument<T>& Argument<T>::memoize(
+    const std::shared_ptr<MemoCache<T>>& shared_cache) {
+  cache = shared_cache;
+  return *this;
+}
+
+template <typename T>
+Argument<T>& Argument<T>::capture(Capture mode) {
+  this->capture_mode = mode;
+  return *this;
+}
+
+template <typename T>
+Argument<T>& Argument<T>::pattern(const std::string& regex) {
+  this->token_pattern = std::make_shared<const Pattern>(regex);
+  return *this;
+}
+
+template <typename T>
+const T& Argument<T>::get() const {
+  if (this->pending.valid() && !this->pending.get() && this->parsed.valid()) {
+    // Waiting on parse_async reports the error, which may exit
+    this->parsed.wait();
+  }
+  return cached ? *cached : value;
+}
+
+template <typename T>
+bool Argument<T>::ready() const {
+  return !this->pending.valid() || this->pending.ready();
+}
+
+// ----------
+// Reloadable
+// ----------
+// An option with one argument that can be replaced after parsing
+template <typename... Policies>
+template <typename T>
+Reloadable<T>& BasicParser<Policies...>::add_reloadable(
+    const std::string& name, char short_name, T def,
+    const Converter<T> converter) {
+  auto* option = new Reloadable<T>(name, short_name, def, converter);
+  enroll_option(option);
+  return *option;
+}
+
+template <typename... Policies>
+template <typename T>
+Reloadable<T>& BasicParser<Policies...>::add_reloadable(
+    const std::string& name, T def, const Converter<T> converter) {
+  return add_reloadable(name, '\0', def, converter);
+}
+
+template <typename T>
+Reloadable<T>::Reloadable(const std::string& name, char short_name,
+                          const T& def, const Converter<T>& converter_)
+    : SingleOption(name, short_name, cpparse::type_name<T>()),
+      snapshots(std::make_shared<const T>(def)),
+      converter(converter_) {}
+
+template <typename T>
+bool Reloadable<T>::store(const std::string& input) {
+  return set(input);
+}
+
+template <typename T>
+bool Reloadable<T>::reload(const std::string& input) {
+  return set(input);
+}
+
+template <typename T>
+bool Reloadable<T>::set(const std::string& input) {
+  auto next = convert_shared(converter, input);
+  if (!next) {
+    return false;
+  }
+  snapshots.publish(std::move(next));
+  return true;
+}
+
+template <typename T>
+const T& Reloadable<T>::get() const {
+  return *static_cast<const T*>(snapshots.get());
+}
+
+template <typename T>
+std::shared_ptr<const T> Reloadable<T>::snapshot() const {
+  return std::static_pointer_cast<const T>(snapshots.snapshot());
+}
+
+template <typename T>
+Reloadable<T>& Reloadable<T>::help(const std::string& new_string) {
+  this->help_text.assign(new_string);
+  return *this;
+}
+
+template <typename T>
+Reloadable<T>& Reloadable<T>::help_entry(std::size_t entry) {
+  this->help_index = entry;
+  return *this;
+}
+
+template <typename T>
+Reloadable<T>& Reloadable<T>::capture(Capture mode) {
+  this->capture_mode = mode;
+  return *this;
+}
+
+// -----
+// Bound
+// -----
+// An option whose value lives in a struct bound with BasicParser::bind
+template <typename T>
+Bound<T>::Bound(const std::string& name, T& storage_,
+                const Converter<T>& converter_)
+    : SingleOption(name, '\0', cpparse::type_name<T>()),
+      storage(storage_),
+      converter(converter_) {}
+
+template <typename T>
+bool Bound<T>::store(const std::string& input) {
+  return try_convert(converter, input, storage);
+}
+
+template <typename T>
+Bound<T>& Bound<T>::help(const std::string& new_string) {
+  this->help_text.assign(new_string);
+  return *this;
+}
+
+template <typename T>
+Bound<T>& Bound<T>::help_entry(std::size_t entry) {
+  this->help_index = entry;
+  return *this;
+}
+
+template <typename T>
+Bound<T>& Bound<T>::capture(Capture mode) {
+  this->capture_mode = mode;
+  return *this;
+}
+
+template <typename T>
+Bound<T>& Binder::field(const std::string& name, T& storage,
+                        const Converter<T> converter) {
+  auto* option = new Bound<T>(prefix + name, storage, converter);
+  enroll(option);
+  return *option;
+}
+
+template <typename S>
+void Binder::group(const std::string& name, S& nested) {
+  Binder binder(enroll, prefix + name);
+  cpparse_bind(binder, nested);
+}
+
+template <typename... Policies>
+template <typename S>
+void BasicParser<Policies...>::bind(const std::string& name_space, S& tree) {
+  Binder binder([this](Option* option) { enroll_option(option); },
+                name_space);
+  cpparse_bind(binder, tree);
+}
+
+// ---------------
+// Memoizing Cache
+// ---------------
+template <typename T>
+MemoCache<T>::MemoCache(std::size_t capacity, const Converter<T>& converter_)
+    : MemoTable(capacity), converter(converter_) {}
+
+template <typename T>
+std::shared_ptr<const T> MemoCache<T>::convert(const std::string& input) {
+  return std::static_pointer_cast<const T>(
+      lookup(input, [this](const std::string& token) {
+        return std::shared_ptr<const void>(convert_shared(converter, token));
+      }));
+}
+
+// -------------------
+// Parallel Conversion
+// -------------------
+// Converting millions of values one at a time leaves every other core idle, so
+// large inputs are split into chunks that pool workers claim from a shared
+// counter. Workers that finish early keep claiming, so one slow chunk doesn't
+// stall the rest.
+
+// Calls `convert` on every index below `size`, which should store the
+// converted token at that index and return false if it couldn't. Returns the
+// first index that failed, or `size` if none did. Other errors are rethrown
+// from the calling thread, again for the first failing index.
+std::size_t convert_all(std::size_t size,
+                        const std::function<bool(std::size_t)>& convert);
+
+// -----------------
+// Variable Argument
+// -----------------
+// A positional argument that takes every value up to the next option
+template <typename... Policies>
+template <typename T>
+VarArgument<T>& BasicParser<Policies...>::add_varargument(
+    const std::string& name, const Converter<T> converter) {
+  auto* arg = new VarArgument<T>(name, converter);
+  enroll_argument(arg);
+  variadic = true;
+  return *arg;
+}
+
+template <typename T>
+VarArgument<T>::VarArgument(const std::string& name,
+                            const Converter<T>& converter_)
+    : MultiOption(name, cpparse::type_name<T>()),
+      value(),
+      converter(converter_) {}
+
+template <typename T>
+std::size_t VarArgument<T>::store_all(const std::vector<std::string>& tokens) {
+  // Converted into a plain array so that workers never share storage, which
+  // std::vector<bool> would
+  std::unique_ptr<T[]> converted(new T[tokens.size()]);
+  std::size_t failure = convert_all(tokens.size(), [&](std::size_t i) {
+    return try_convert(converter, tokens[i], converted[i]);
+  });
+  if (failure == tokens.size()) {
+    value.assign(std::make_move_iterator(converted.get()),
+                 std::make_move_iterator(converted.get() + tokens.size()));
+  }
+  return failure;
+}
+
+template <typename T>
+VarArgument<T>& VarArgument<T>::help(const std::string& new_string) {
+  this->help_text.assign(new_string);
+  return *this;
+}
+
+template <typename T>
+VarArgument<T>& VarArgument<T>::help_entry(std::size_t entry) {
+  this->help_index = entry;
+  return *this;
+}
+
+template <typename T>
+VarArgument<T>& VarArgument<T>::capture(Capture mode) {
+  this->capture_mode = mode;
+  return *this;
+}
+
+template <typename T>
+const std::vector<T>& VarArgument<T>::get() const {
+  return value;
+}
+
+// ------
+// Errors
+// ------
+#ifdef CPPARSE_NO_EXCEPTIONS
+ErrorHandler& error_handler();
+#endif
+
+// Mistakes in setting up a parser throw `Error`, or go to the error handler
+// when built without exceptions
+template <typename Error>
+[[noreturn]] void fail(const std::string& message) {
+#ifdef CPPARSE_NO_EXCEPTIONS
+  error_handler()(message.c_str());
+  std::abort();  // In case the handler returned
+#else
+  throw Error(message);
+#endif
+}
+
+// ---------------------
+// Fixed Capacity Parser
+// ---------------------
+
+// Read a whole number in [min, max] from `input`, false if there's anything
+// else. These are what assign_fixed is built on.
+bool read_fixed(const char* input, long long min, long long max,
+                long long& output);
+bool read_fixed(const char* input, unsigned long long min,
+                unsigned long long max, unsigned long long& output);
+bool read_fixed(const char* input, long double min, long double max,
+                long double& output);
+
+// The tables of a FixedParser, so that lookup and parsing are compiled once
+// rather than for every capacity
+struct FixedTables {
+  const Descriptor* options;
+  std::size_t option_count;
+  const unsigned char* short_options;  // Index + 1 into options, 0 if none
+  std::size_t short_count;
+  const Descriptor* arguments;
+  std::size_t argument_count;
+  char* error;  // Message of the first error, truncated to `error_size`
+  std::size_t error_size;
+};
+
+const Descriptor* find_fixed(const FixedTables& tables, const char* name);
+bool parse_fixed(const FixedTables& tables, int argc, char** argv);
+
+// The widest type of the same kind as T
+template <typename T>
+using FixedWide = typename std::conditional<
+    std::is_floating_point<T>::value, long double,
+    typename std::conditional<std::is_signed<T>::value, long long,
+                              unsigned long long>::type>::type;
+
+template <typename T>
+bool assign_fixed(void* storage, const char* input) {
+  static_assert(std::is_arithmetic<T>::value,
+                "FixedParser values must be numbers, bool, or const char*");
+  FixedWide<T> value;
+  if (!read_fixed(input, FixedWide<T>(std::numeric_limits<T>::lowest()),
+                  FixedWide<T>(std::numeric_limits<T>::max()), value)) {
+    return false;
+  }
+  *static_cast<T*>(storage) = static_cast<T>(value);
+  return true;
+}
+
+template <std::size_t MaxOptions, std::size_t MaxArguments,
+          std::size_t NameBytes>
+FixedParser<MaxOptions, MaxArguments, NameBytes>::FixedParser()
+    : short_options(),
+      option_count(0),
+      argument_count(0),
+      name_bytes(0),
+      error_message() {}
+
+template <std::size_t MaxOptions, std::size_t MaxArguments,
+          std::size_t NameBytes>
+const char* FixedParser<MaxOptions, MaxArguments, NameBytes>::copy_name(
+    const char* name) {
+  std::size_t size = std::strlen(name) + 1;
+  if (size > NameBytes - name_bytes) {
+    fail<std::length_error>(std::string("No room for the name \"") + name +
+                            "\", raise NameBytes");
+  }
+  char* copy = names + name_bytes;
+  std::memcpy(copy, name, size);
+  name_bytes += size;
+  return copy;
+}
+
+template <std::size_t MaxOptions, std::size_t MaxArguments,
+          std::size_t NameBytes>
+void FixedParser<MaxOptions, MaxArguments, NameBytes>::enroll_option(
+    const Descriptor& option) {
+  if (option_count == MaxOptions) {
+    fail<std::length_error>(std::string("No room for the option \"") +
+                            option.name + "\", raise MaxOptions");
+  }
+  if (find_fixed(tables(), option.name)) {
+    fail<std::invalid_argument>(
+        std::string("Can't add two options with the same name: \"") +
+        option.name + '"');
+  }
+  auto short_name = static_cast<unsigned char>(option.short_name);
+  if (short_name >= sizeof(short_options)) {
+    fail<std::invalid_argument>(std::string("Short names must be ASCII: \"") +
+                                option.name + '"');
+  }
+  if (short_name && short_options[short_name]) {
+    fail<std::invalid_argument>(
+        std::string("Can't add two options with the same short name: '") +
+        option.short_name + '\'');
+  }
+  options[option_count] = option;
+  options[option_count].name = copy_name(option.name);
+  option_count++;
+  if (short_name) {
+    short_options[short_name] = static_cast<unsigned char>(option_count);
+  }
+}
+
+template <std::size_t MaxOptions, std::size_t MaxArguments,
+          std::size_t NameBytes>
+FixedTables FixedParser<MaxOptions, MaxArguments, NameBytes>::tables() {
+  return FixedTables{options,        option_count,
+                     short_options,  sizeof(short_options),
+                     arguments,      argument_count,
+                     error_message,  sizeof(error_message)};
+}
+
+template <std::size_t MaxOptions, std::size_t MaxArguments,
+          std::size_t NameBytes>
+void FixedParser<MaxOptions, MaxArguments, NameBytes>::add_flag(
+    const char* name, char short_name, bool& storage, const char* help) {
+  enroll_option(Descriptor{name, short_name, help, "bool", &storage, false,
+                           assign_descriptor_flag});
+}
+
+template <std::size_t MaxOptions, std::size_t MaxArguments,
+          std::size_t NameBytes>
+template <typename T>
+void FixedParser<MaxOptions, MaxArguments, NameBytes>::add_option(
+    const char* name, char short_name, T& storage, const char* help) {
+  enroll_option(Descriptor{name, short_name, help, cpparse::type_name<T>(),
+                           &storage, true, assign_fixed<T>});
+}
+
+template <std::size_t MaxOptions, std::size_t MaxArguments,
+          std::size_t NameBytes>
+template <typename T>
+void FixedParser<MaxOptions, MaxArguments, NameBytes>::add_argument(
+    const char* name, T& storage, const char* help) {
+  if (argument_count == MaxArguments) {
+    fail<std::length_error>(std::string("No room for the argument \"") +
+                            name + "\", raise MaxArguments");
+  }
+  arguments[argument_count++] =
+      Descriptor{copy_name(name), '\0', help, cpparse::type_name<T>(),
+                 &storage, true, assign_fixed<T>};
+}
+
+template <std::size_t MaxOptions, std::size_t MaxArguments,
+          std::size_t NameBytes>
+bool FixedParser<MaxOptions, MaxArguments, NameBytes>::parse(int argc,
+                                                              char** argv) {
+  return parse_fixed(tables(), argc, argv);
+}
+
+template <std::size_t MaxOptions, std::size_t MaxArguments,
+          std::size_t NameBytes>
+const char* FixedParser<MaxOptions, MaxArguments, NameBytes>::error() const {
+  return error_message;
+}
+
+// ---------------------
+// String Interpretation
+// ---------------------
+// Implementations of default string interpretations
+
+// Calls `extract` on a stream over `input` that reads "true" as true, and
+// returns whether all of `input` was used. The stream is made in the library so
+// that this header doesn't need <sstream>.
+bool read_stream(const std::string& input,
+                 void (*extract)(std::istream& stream, void* output),
+                 void* output);
+
+template <typename T>
+void extract(std::istream& stream, void* output) {
+  stream >> *static_cast<T*>(output);
+}
+
+#ifdef CPPARSE_NO_EXCEPTIONS
+template <typename T>
+bool read(const std::string& input, T& output) {
+  return read_stream(input, extract<T>, &output);
+}
+#else
+template <typename T>
+T read(const std::string& input) {
+  T result;
+  if (read_stream(input, extract<T>, &result)) {
+    return result;
+  } else {
+    throw std::invalid_argument("Couldn't parse string");
+  }
+}
+#endif
+}
+
+#endif
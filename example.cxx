@@ -43,6 +43,11 @@ int main(int argc, char** argv) {
       "they also wrap.");
   // All argument types also support adding help text with the `help` method.
 
+  // A variable argument collects every remaining positional argument into a
+  // vector. It must be the last positional argument added. Very long lists are
+  // converted in parallel.
+  auto& rest_args = parser.add_varargument<double>("rest");
+
   // This extra argument helps show usage indentation
   parser.add_optargument<>("extra-argument");
 
@@ -56,5 +61,6 @@ int main(int argc, char** argv) {
   cout << "Boolean flag   : " << boolalpha << bool_flag.get() << '\n';
   cout << "String flag    : " << string_flag.get() << '\n';
   cout << "Double option  : " << double_opt.get() << '\n';
-  cout << "Int argument   : " << int_arg.get() << endl;
+  cout << "Int argument   : " << int_arg.get() << '\n';
+  cout << "Rest arguments : " << rest_args.get().size() << endl;
 }
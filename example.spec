@@ -0,0 +1,10 @@
+# Spec for gen_example, the same options as example.cxx
+class ExampleParser
+compresshelp
+description This is a test program with a description! If descriptions are long enough, they'll wrap.
+flag bool bool b true false
+flag std::string string - "set" "unset"
+option double double d - This option has a long name, so its help goes on a new line.
+option std::string extra-argument - -
+argument int integer This integer is required but unused. If descriptions are long enough, they also wrap.
+varargument double rest
@@ -0,0 +1,52 @@
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "cpparse.hxx"
+
+// Every allocation through new, to show that the parser makes none
+static std::size_t allocations = 0;
+
+void* operator new(std::size_t size) {
+  allocations++;
+  if (void* memory = std::malloc(size ? size : 1)) {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+
+void operator delete(void* memory, std::size_t size) noexcept {
+  (void)size;
+  std::free(memory);
+}
+
+int main(int argc, char** argv) {
+  bool verbose = false;
+  int count = 1;
+  double ratio = 0.5;
+  const char* output = "-";
+  const char* input = nullptr;
+
+  // The same work a child might do between vfork and exec
+  std::size_t before = allocations;
+  cpparse::FixedParser<4, 1> parser;
+  parser.add_flag("verbose", 'v', verbose, "Say more");
+  parser.add_option("count", 'c', count, "How many times");
+  parser.add_option("ratio", '\0', ratio);
+  parser.add_option("output", 'o', output, "Where to write");
+  parser.add_argument("input", input, "What to read");
+  bool parsed = parser.parse(argc, argv);
+  std::size_t made = allocations - before;
+
+  if (!parsed) {
+    std::fprintf(stderr, "%s\n", parser.error());
+    return 1;
+  }
+  std::printf("Verbose     : %s\n", verbose ? "true" : "false");
+  std::printf("Count       : %d\n", count);
+  std::printf("Ratio       : %g\n", ratio);
+  std::printf("Output      : %s\n", output);
+  std::printf("Input       : %s\n", input);
+  std::printf("Allocations : %zu\n", made);
+}
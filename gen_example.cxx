@@ -0,0 +1,26 @@
+#include <iostream>
+#include <string>
+#include "gen_example.hxx"
+
+using namespace std;
+
+int main(int argc, char** argv) {
+  // The same program as example, but with a parser generated ahead of time
+  // from example.spec by `cpparse_gen example.spec -o gen_example.hxx`.
+  ExampleParser parser;
+  parser.parse(argc, argv);
+
+  // Every option is a member with the same `get` method as the runtime
+  // options, so code reading values doesn't change
+  auto& bool_flag = parser.bool_;
+  auto& string_flag = parser.string;
+  auto& double_opt = parser.double_;
+  auto& int_arg = parser.integer;
+  auto& rest_args = parser.rest;
+
+  cout << "Boolean flag   : " << boolalpha << bool_flag.get() << '\n';
+  cout << "String flag    : " << string_flag.get() << '\n';
+  cout << "Double option  : " << double_opt.get() << '\n';
+  cout << "Int argument   : " << int_arg.get() << '\n';
+  cout << "Rest arguments : " << rest_args.get().size() << endl;
+}
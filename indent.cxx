@@ -5,14 +5,15 @@
 
 namespace indent {
 
-Indenter::Indenter(std::ostream& stream_, unsigned current_,
-                   unsigned max_length_, unsigned indent_)
+INDENT_INLINE Indenter::Indenter(std::ostream& stream_, unsigned current_,
+                                 unsigned max_length_, unsigned indent_)
     : stream(stream_),
       max_length(max_length_),
       indent(indent_),
       current(current_) {}
 
-Indenter& operator<<(Indenter& indenter, const std::string& word) {
+INDENT_INLINE Indenter& operator<<(Indenter& indenter,
+                                  const std::string& word) {
   if (indenter.current > indenter.indent &&
       indenter.current + word.size() + 1 >= indenter.max_length) {
     indenter.stream << '\n';
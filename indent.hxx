@@ -4,6 +4,11 @@
 #include <string>
 #include <iostream>
 
+// Inline when pulled in by indent_header.hxx, compiled on its own otherwise
+#ifndef INDENT_INLINE
+#define INDENT_INLINE
+#endif
+
 namespace indent {
 class Indenter {
   std::ostream& stream;
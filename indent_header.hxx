@@ -1,6 +1,7 @@
 #ifndef INDENT_HEADER_HXX
 #define INDENT_HEADER_HXX
 
+#define INDENT_INLINE inline
 #include "indent.hxx"
 #include "indent.cxx"
 
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Compare compile time of N translation units that include cpparse.hxx
+# against N that import the cpparse module. Every unit builds and runs a
+# parser, so the templates are instantiated the way real code would. Expects
+# the module to be built by the same compiler, and fails if that compiler
+# can't compile such an importer (g++ 12 crashes), since there would be
+# nothing to compare.
+set -e
+
+N=${1:-500}
+CXX=${CXX:-g++}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# A translation unit using the parser, after `$1` to bring cpparse in
+unit() {
+  printf '%s\n' "$1"
+  printf 'int tu_%d(int argc, char** argv) {\n' "$2"
+  printf '  cpparse::Parser parser("Translation unit %d");\n' "$2"
+  printf '  auto& count = parser.add_optargument<int>("count", '"'c'"');\n'
+  printf '  auto& name = parser.add_argument<>("name");\n'
+  printf '  parser.parse(argc, argv);\n'
+  printf '  return count.get() + static_cast<int>(name.get().size());\n'
+  printf '}\n'
+}
+
+mkdir "$DIR/header" "$DIR/module"
+ln -s "$PWD/gcm.cache" "$DIR/module/gcm.cache"
+unit 'import cpparse;' 0 > "$DIR/module/check.cxx"
+if ! (cd "$DIR/module" && $CXX -std=c++20 -fmodules-ts -pthread -c \
+        -o /dev/null check.cxx) > /dev/null 2>&1; then
+  echo "$($CXX --version | head -n 1) can't compile a translation unit that" \
+       "imports cpparse and builds a parser, set CXX to one that can" >&2
+  exit 1
+fi
+
+i=0
+while [ $i -lt "$N" ]; do
+  unit '#include "cpparse.hxx"' $i > "$DIR/header/tu_$i.cxx"
+  unit 'import cpparse;' $i > "$DIR/module/tu_$i.cxx"
+  i=$((i + 1))
+done
+
+compile() {
+  start=$(date +%s.%N)
+  (cd "$DIR/$1" && for f in tu_*.cxx; do
+    $CXX $2 -I"$OLDPWD" -c -o /dev/null "$f"
+  done)
+  end=$(date +%s.%N)
+  awk -v s="$start" -v e="$end" -v n="$N" -v k="$1" \
+    'BEGIN { printf "%s: %.2f s for %d translation units\n", k, e - s, n }'
+}
+
+compile header "-std=c++14 -DCPPARSE_LIBRARY -pthread"
+compile module "-std=c++20 -fmodules-ts -pthread"
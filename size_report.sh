@@ -0,0 +1,47 @@
+#!/bin/sh
+# Report how many bytes of code each option value type adds. Compiles a
+# translation unit that uses every kind of option with N distinct types, and
+# one that uses none, against the separately compiled library, then divides
+# the difference in .text by N. The generated code is never run.
+set -e
+
+N=${1:-32}
+CXX=${CXX:-g++}
+CFLAGS=${CFLAGS:-"-std=c++14 -O3 -pthread"}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+generate() {
+  echo '#include <string>'
+  echo '#include "cpparse.hxx"'
+  i=0
+  while [ $i -lt "$1" ]; do
+    echo "struct Type$i { int value; };"
+    i=$((i + 1))
+  done
+  echo 'void use(cpparse::Parser& parser) {'
+  i=0
+  while [ $i -lt "$1" ]; do
+    echo "  auto read$i = [](const std::string& s) {"
+    echo "    return Type$i{std::stoi(s)};"
+    echo "  };"
+    echo "  parser.add_flag<Type$i>(\"flag$i\", Type$i{1}, Type$i{0});"
+    echo "  parser.add_optargument<Type$i>(\"opt$i\", Type$i{0}, read$i);"
+    echo "  parser.add_reloadable<Type$i>(\"reload$i\", Type$i{0}, read$i);"
+    echo "  parser.add_varargument<Type$i>(\"rest$i\", read$i);"
+    i=$((i + 1))
+  done
+  echo '}'
+}
+
+text() {
+  generate "$1" > "$DIR/types_$1.cxx"
+  $CXX $CFLAGS -DCPPARSE_LIBRARY -I"$PWD" -c -o "$DIR/types_$1.o" \
+    "$DIR/types_$1.cxx"
+  size -A "$DIR/types_$1.o" |
+    awk '$1 ~ /^\.text/ { sum += $2 } END { print sum }'
+}
+
+base=$(text 0)
+used=$(text "$N")
+echo "$N types: $used bytes of .text, $(( (used - base) / N )) bytes per type"
@@ -0,0 +1,27 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "cpparse.hxx"
+
+// Program run by tests.cxx, built without exceptions or rtti. Input that
+// can't be converted is reported like any other parse error, and a mistake in
+// setting up the parser goes to the handler set here.
+
+int main(int argc, char** argv) {
+  cpparse::set_error_handler([](const char* message) {
+    std::printf("handler: %s\n", message);
+    std::exit(3);
+  });
+  cpparse::Parser parser;
+  auto& level = parser.add_optargument<int>("level", 'l', 0);
+  auto& even = parser.add_optargument<int>(
+      "even", 'e', 0, [](const std::string& input, int& output) {
+        return cpparse::read<int>(input, output) && output % 2 == 0;
+      });
+  auto& twice = parser.add_flag<>("twice", 't', true);
+  parser.parse(argc, argv);
+  if (twice.get()) {
+    parser.add_flag<>("level", true);
+  }
+  std::printf("level %d even %d\n", level.get(), even.get());
+}
@@ -0,0 +1,16 @@
+#include <string>
+#include "cpparse.hxx"
+
+// Plugin loaded by tests.cxx. Adds a positional while the command line is
+// being parsed, which must not disturb the positionals already read.
+
+static int second = 0;
+
+extern "C" void cpparse_register(cpparse::Parser& parser) {
+  parser.add_flag<>("plugged", true);
+  parser.add_argument<int>("second", [](const std::string& input) {
+    return second = cpparse::read<int>(input);
+  });
+}
+
+extern "C" int plugin_second() { return second; }
@@ -0,0 +1,846 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cpparse.hxx"
+#include "gen_example.hxx"
+
+#include <dlfcn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace cpparse;
+
+// Regression checks, run with `make test`. Parsers keep their errors rather
+// than exiting, so every case runs in this one process.
+
+static int failures = 0;
+
+// Every allocation through new, so tests can check that code makes none. Not
+// inlined, or g++ sees malloc paired with delete at every call site.
+static atomic<size_t> allocations(0);
+
+__attribute__((noinline)) void* operator new(size_t size) {
+  allocations++;
+  if (void* memory = malloc(size ? size : 1)) {
+    return memory;
+  }
+  throw bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* memory) noexcept {
+  free(memory);
+}
+
+__attribute__((noinline)) void operator delete(void* memory,
+                                               size_t size) noexcept {
+  (void)size;
+  free(memory);
+}
+
+static void check(bool passed, const string& what) {
+  if (!passed) {
+    cerr << "FAILED: " << what << '\n';
+    failures++;
+  }
+}
+
+// A command line of `tokens`, with a program name in front
+class CommandLine {
+  vector<string> tokens;
+  vector<char*> pointers;
+
+ public:
+  explicit CommandLine(vector<string> tokens_) : tokens(move(tokens_)) {
+    tokens.insert(tokens.begin(), "test");
+    for (auto& token : tokens) {
+      pointers.push_back(&token[0]);
+    }
+    pointers.push_back(nullptr);
+  }
+
+  int argc() const { return static_cast<int>(tokens.size()); }
+  char** argv() { return pointers.data(); }
+};
+
+// Parse `tokens` as a command line
+template <typename Parser>
+static bool parse(Parser& parser, vector<string> tokens) {
+  CommandLine line(move(tokens));
+  return parser.parse(line.argc(), line.argv());
+}
+
+// --------------
+// Capture Corpus
+// --------------
+static void test_capture_corpus() {
+  const string path = "test_capture.corpus";
+  remove(path.c_str());
+  BasicParser<ReturnErrors> parser;
+  parser.add_flag<>("verbose", 'v', true);
+  parser.add_optargument<string>("password", 'p', "").capture(Capture::redact);
+  auto& port =
+      parser.add_optargument<int>("port", 'o', 0).capture(Capture::hash);
+  parser.capture(path);
+  check(parse(parser, {"-vpHunter2", "-o", "8080"}), "capture a parse");
+  check(parse(parser, {"-vo8080"}), "capture a second parse");
+
+  auto corpus = read_corpus(path);
+  check(corpus.size() == 2 && corpus[0].size() == 4 && corpus[1].size() == 2,
+        "corpus keeps every command line");
+  if (corpus.size() != 2 || corpus[0].size() != 4 || corpus[1].size() != 2) {
+    remove(path.c_str());
+    return;
+  }
+  check(corpus[0][1] == "-vpXxxxxx0", "redaction keeps bundled options");
+  check(corpus[0][3].size() == 4 && corpus[1][1].substr(3) == corpus[0][3],
+        "a value hashes the same bundled or not");
+  vector<string> replayed(corpus[0].begin() + 1, corpus[0].end());
+  check(parse(parser, replayed) && port.get() > 0 && port.get() <= 8080,
+        "a hashed number still parses");
+  remove(path.c_str());
+}
+
+// -----------------------
+// Distributed Definitions
+// -----------------------
+#if defined(__GNUC__) && defined(__ELF__)
+// Picked up by every parser in this file, without running any code at startup
+CPPARSE_FLAG(descriptor_flag, "descriptor-flag", '\0', "Defined by a macro");
+CPPARSE_OPTION(int, descriptor_level, "descriptor-level", '\0', 2,
+               "Defined by a macro too");
+
+static void test_descriptors() {
+  BasicParser<ReturnErrors> parser;
+  check(!descriptor_flag && descriptor_level == 2,
+        "descriptor options start at their defaults");
+  check(parse(parser, {"--descriptor-flag", "--descriptor-level", "7"}),
+        "descriptor options parse");
+  check(descriptor_flag && descriptor_level == 7,
+        "descriptor options write their variables");
+  check(!parse(parser, {"--descriptor-level", "x"}) &&
+            parser.errors().error.kind == ParseError::Kind::invalid_argument &&
+            string(parser.errors().error.type) == "int",
+        "descriptor options report bad values");
+  ostringstream help;
+  help << parser.help();
+  check(help.str().find("Defined by a macro too") != string::npos,
+        "descriptor options have help");
+}
+#endif
+
+// --------------------
+// Variadic Positionals
+// --------------------
+static void test_variadic_after_option() {
+  BasicParser<ReturnErrors> parser;
+  auto& flag = parser.add_flag<>("bool", 'b', true);
+  auto& integer = parser.add_argument<int>("integer");
+  auto& rest = parser.add_varargument<double>("rest");
+  check(parse(parser, {"5", "1", "2", "-b", "3"}),
+        "varargs continue after an option");
+  check(flag.get() && integer.get() == 5, "options between varargs");
+  check(rest.get() == vector<double>({1, 2, 3}), "varargs collect every value");
+
+  BasicParser<ReturnErrors> bad;
+  bad.add_flag<>("bool", 'b', true);
+  bad.add_varargument<int>("values");
+  check(!parse(bad, {"1", "-b", "x"}), "bad vararg after an option fails");
+  check(bad.errors().error.kind == ParseError::Kind::invalid_argument &&
+            bad.errors().error.argument == "x",
+        "bad vararg after an option is a conversion error");
+}
+
+// -------
+// Prescan
+// -------
+// Output and exit status of prescan on `tokens`, run in a child since it
+// exits when it finds help or version; status 2 if it returned
+static string prescanned(vector<string> tokens, const char* version,
+                         const char* help) {
+  int pipes[2];
+  if (pipe(pipes)) {
+    return "";
+  }
+  fflush(nullptr);
+  pid_t child = fork();
+  if (child == 0) {
+    dup2(pipes[1], STDOUT_FILENO);
+    close(pipes[0]);
+    CommandLine line(move(tokens));
+    prescan(line.argc(), line.argv(), version, help);
+    _exit(2);
+  }
+  close(pipes[1]);
+  string output;
+  char buffer[256];
+  ssize_t count;
+  while ((count = read(pipes[0], buffer, sizeof(buffer))) > 0) {
+    output.append(buffer, count);
+  }
+  close(pipes[0]);
+  int status = 0;
+  waitpid(child, &status, 0);
+  return output + "status " + to_string(WEXITSTATUS(status)) + '\n';
+}
+
+static void test_prescan() {
+  // Returning at all is the check here
+  CommandLine plain({"-v", "input", "--level", "3"});
+  prescan(plain.argc(), plain.argv(), "1.0", "help\n");
+  CommandLine untexted({"--help", "--version"});
+  prescan(untexted.argc(), untexted.argv(), nullptr, nullptr);
+
+  check(prescanned({"-v", "--help"}, "1.0", "help\n") == "help\nstatus 0\n",
+        "prescan prints help and exits");
+  check(prescanned({"-h", "--version"}, "1.0", "help\n") ==
+            "help\nstatus 0\n",
+        "prescan takes the first of help and version");
+  check(prescanned({"x", "--version"}, "1.0", "help\n") == "1.0\nstatus 0\n",
+        "prescan prints the version and exits");
+  check(prescanned({"--", "--help"}, "1.0", "help\n") == "status 2\n",
+        "prescan stops at --");
+  check(prescanned({"--helpful", "-vh"}, "1.0", "help\n") == "status 2\n",
+        "prescan only matches exact tokens");
+  check(prescanned({"--help"}, "1.0", nullptr) == "status 2\n",
+        "prescan ignores help without text");
+}
+
+// ----------------
+// Bootstrap Parses
+// ----------------
+static bool in_bootstrap = false;  // Whether exiting now is a failure
+
+static void test_parse_known() {
+  atexit([]() {
+    if (in_bootstrap) {
+      cerr << "FAILED: parse_known exited\n";
+      _exit(1);
+    }
+  });
+  BasicParser<ReturnErrors> boot;
+  auto& config = boot.add_optargument<string>("config", 'c');
+  auto& level = boot.add_optargument<int>("level", 'l');
+  CommandLine line({"-zc", "x", "--unknown", "value", "input", "--level", "3",
+                    "-qw"});
+  check(boot.parse_known(line.argc(), line.argv()),
+        "parse_known skips unknown options and extra values");
+  check(config.get() == "" && level.get() == 3,
+        "a bundle with an unknown option is dropped, known options are read");
+
+  CommandLine help({"-c", "x", "-h", "--help"});
+  in_bootstrap = true;
+  check(boot.parse_known(help.argc(), help.argv()) && config.get() == "x",
+        "parse_known leaves help for the full parse");
+  in_bootstrap = false;
+
+  BasicParser<ReturnErrors> full;
+  full.add_optargument<string>("config", 'c');
+  check(!parse(full, {"-c", "x", "--unknown"}),
+        "parse still rejects unknown options");
+}
+
+// ---------------------
+// Expensive Conversions
+// ---------------------
+static void test_repeated_expensive_option() {
+  // The first conversion is the slow one, so it would finish last if both ran
+  // at once
+  auto slow_double = [](const string& input) {
+    if (input == "a") {
+      this_thread::sleep_for(chrono::milliseconds(50));
+    }
+    return input + input;
+  };
+  BasicParser<ReturnErrors> parser;
+  auto& value =
+      parser.add_optargument<string>("value", 'm', "", slow_double).expensive();
+  check(parse(parser, {"-m", "a", "-m", "b"}), "repeated expensive option");
+  check(value.get() == "bb", "the last expensive value wins");
+}
+
+static void test_expensive_thread_bound() {
+  mutex lock;
+  set<thread::id> threads;
+  auto record = [&](const string& input) {
+    this_thread::sleep_for(chrono::milliseconds(2));
+    lock_guard<mutex> guard(lock);
+    threads.insert(this_thread::get_id());
+    return input;
+  };
+  BasicParser<ReturnErrors> parser;
+  vector<string> tokens;
+  for (int i = 0; i < 64; i++) {
+    string name = "option-" + to_string(i);
+    parser.add_optargument<string>(name, '\0', "", record).expensive();
+    tokens.push_back("--" + name);
+    tokens.push_back("value");
+  }
+  auto& many = parser.add_varargument<int>("many");
+  for (int i = 0; i < 20000; i++) {
+    tokens.push_back(to_string(i));
+  }
+  check(parse(parser, tokens), "many expensive options parse");
+  check(many.get().size() == 20000 && many.get().back() == 19999,
+        "a large vararg converts in parallel");
+  // The pool, plus the parsing thread running work no worker got to
+  unsigned limit = max(1u, thread::hardware_concurrency()) + 1;
+  check(threads.size() <= limit, "expensive conversions share a bounded pool");
+}
+
+// Keeps the first error along with the thread that reported it
+struct ThreadSink : FirstErrorSink {
+  thread::id reporter;
+
+  void report(const ParseError& error, const UsageFormatter& usage) {
+    if (!failed) {
+      reporter = this_thread::get_id();
+    }
+    FirstErrorSink::report(error, usage);
+  }
+};
+
+struct ThreadErrors : virtual DefaultPolicies {
+  using ErrorSink = ThreadSink;
+};
+
+static void test_async_error_thread() {
+  BasicParser<ThreadErrors> parser;
+  parser.add_optargument<int>("number", 'n').expensive();
+  string program = "test", flag = "-n", number = "x";
+  char* argv[] = {&program[0], &flag[0], &number[0], nullptr};
+  Task task = parser.parse_async(3, argv);
+  task.wait();
+  check(!task.get(), "a bad expensive option fails the task");
+  check(parser.errors().failed &&
+            parser.errors().reporter == this_thread::get_id(),
+        "async errors are reported on the waiting thread");
+}
+
+// ----------------
+// Parse Statistics
+// ----------------
+static void test_stats() {
+  BasicParser<ReturnErrors> parser;
+  parser.collect_stats();
+  parser.add_flag<>("bool", 'b', true);
+  auto& slow = parser.add_optargument<int>("slow", 's').expensive();
+  check(parse(parser, {"-b", "--bool", "-s", "4"}), "parse with statistics");
+  check(parser.stats().lookups == 3, "only lookups that run are counted");
+
+  CommandLine line({"-s", "5"});
+  Task task = parser.parse_async(line.argc(), line.argv());
+  ostringstream help;
+  help << parser.help();  // Timed while the background may still be joining
+  check(task.get() && slow.get() == 5, "parse_async with statistics");
+  check(parser.stats().conversions == 1 && parser.stats().lookups == 1,
+        "background statistics are added once the task is waited for");
+}
+
+#ifndef CPPARSE_USDT
+static void test_probes_compile_out() {
+  int evaluated = 0;
+  if (evaluated == 0)
+    CPPARSE_PROBE(parse__start, ++evaluated);
+  else
+    CPPARSE_PROBE(parse__end, ++evaluated);
+  check(evaluated == 0, "probes without USDT don't evaluate their arguments");
+
+  // Every probe site still does its work
+  BasicParser<ReturnErrors> parser;
+  auto& level = parser.add_optargument<int>("level", 'l', 0);
+  check(parse(parser, {"-l", "3"}) && level.get() == 3, "probed parse");
+  check(!parse(parser, {"-l", "x"}) &&
+            parser.errors().error.kind == ParseError::Kind::invalid_argument,
+        "probed conversion failure");
+  ostringstream help, usage;
+  help << parser.help();
+  usage << parser.usage();
+  check(help.str().find(usage.str()) == 0 &&
+            usage.str().find("[-l <level>]") != string::npos,
+        "probed help and usage");
+}
+#endif
+
+// -----------
+// Error Sinks
+// -----------
+static void test_reused_parser_errors() {
+  BasicParser<ReturnErrors> parser;
+  auto& number = parser.add_optargument<int>("number", 'n');
+  check(!parse(parser, {"-n", "x"}), "bad number fails");
+  check(parse(parser, {"-n", "3"}), "a reused parser can succeed");
+  check(!parser.errors().failed && number.get() == 3,
+        "errors are only kept from the latest parse");
+}
+
+// --------
+// Patterns
+// --------
+static void test_pattern_repeats() {
+  check(Pattern("ab{0}c").matches("ac") && !Pattern("ab{0}c").matches("abc"),
+        "{0} repeats nothing");
+  check(Pattern("ab{0,0}c").matches("ac") &&
+            !Pattern("ab{0,0}c").matches("abbc"),
+        "{0,0} repeats nothing");
+  check(!Pattern("ab{2,}").matches("ab") && Pattern("ab{2,}").matches("abb") &&
+            Pattern("ab{2,}").matches("abbbbb"),
+        "{2,} repeats two or more");
+  check(Pattern("ab{1,2}").matches("abb") &&
+            !Pattern("ab{1,2}").matches("abbb"),
+        "{1,2} repeats at most twice");
+}
+
+// ---------------------
+// Fixed Capacity Parser
+// ---------------------
+static void test_fixed_bool() {
+  bool value = false;
+  FixedParser<1, 1, 16> parser;
+  parser.add_option("value", 'v', value);
+  check(parse(parser, {"-v", "true"}) && value, "fixed bool reads true");
+  check(parse(parser, {"-v", "0"}) && !value, "fixed bool reads 0");
+  check(!parse(parser, {"-v", "yes"}), "fixed bool rejects other words");
+}
+
+static void test_fixed_allocations() {
+  bool verbose = false;
+  int count = 1;
+  const char* input = nullptr;
+  CommandLine good({"-v", "--count", "3", "file"});
+  CommandLine bad({"--count", "many", "file"});
+
+  size_t before = allocations;
+  FixedParser<2, 1> parser;
+  parser.add_flag("verbose", 'v', verbose, "Say more");
+  parser.add_option("count", 'c', count, "How many times");
+  parser.add_argument("input", input, "What to read");
+  bool parsed = parser.parse(good.argc(), good.argv());
+  bool rejected = !parser.parse(bad.argc(), bad.argv());
+  size_t made = allocations - before;
+
+  check(parsed && verbose && count == 3 && string(input) == "file",
+        "fixed parser reads every kind of value");
+  check(rejected && *parser.error(), "fixed parser reports errors");
+  check(made == 0, "fixed parser never allocates, even to report errors");
+}
+
+// -----------------
+// Constraint Groups
+// -----------------
+// Whether adding the group fails at spec time
+template <typename Parser>
+static bool rejects_group(Parser& parser, Group kind,
+                          const vector<string>& names) {
+  try {
+    parser.add_group(kind, names);
+  } catch (const invalid_argument&) {
+    return true;
+  }
+  return false;
+}
+
+static void test_groups() {
+  BasicParser<ReturnErrors> parser;
+  parser.add_flag<>("json", 'j', true);
+  parser.add_flag<>("yaml", 'y', true);
+  parser.add_optargument<string>("cert");
+  parser.add_optargument<string>("key");
+  parser.add_group(Group::exactly_one, {"json", "yaml"});
+  parser.add_group(Group::together, {"cert", "key"});
+
+  check(parse(parser, {"-j"}), "one of an exactly_one group parses");
+  check(parse(parser, {"-y", "--cert", "c", "--key", "k"}),
+        "a whole together group parses");
+  check(!parse(parser, {"-j", "-y"}) &&
+            parser.errors().error.kind ==
+                ParseError::Kind::conflicting_options &&
+            parser.errors().error.name == "json" &&
+            parser.errors().error.argument == "yaml",
+        "exactly_one rejects two members");
+  check(!parse(parser, {}) &&
+            parser.errors().error.kind == ParseError::Kind::missing_choice,
+        "exactly_one rejects no members");
+  check(!parse(parser, {"-j", "--cert", "c"}) &&
+            parser.errors().error.kind ==
+                ParseError::Kind::missing_companion &&
+            parser.errors().error.name == "cert" &&
+            parser.errors().error.argument == "key",
+        "together rejects a partial group");
+
+  check(rejects_group(parser, Group::exclusive, {}),
+        "an empty group is rejected");
+  check(rejects_group(parser, Group::exclusive, {"json", "json"}),
+        "a group naming an option twice is rejected");
+  check(rejects_group(parser, Group::exclusive, {"json", "xml"}),
+        "a group naming an unknown option is rejected");
+}
+
+// ----------------
+// Required Options
+// ----------------
+static void test_required() {
+  BasicParser<ReturnErrors> parser;
+  auto& user = parser.add_optargument<string>("user", 'u');
+  parser.add_optargument<string>("host");
+  parser.add_flag<>("verbose", 'v', true);
+  parser.require({"user", "host"});
+  parser.set_program_name("test");
+
+  check(parse(parser, {"-u", "me", "--host", "here"}) && user.get() == "me",
+        "given required options parse");
+  check(!parse(parser, {"-v"}) &&
+            parser.errors().error.kind == ParseError::Kind::missing_options &&
+            parser.errors().error.name == "\"user\", \"host\"",
+        "every missing required option is reported at once");
+  check(!parse(parser, {"-u", "me"}) &&
+            parser.errors().error.name == "\"host\"" &&
+            string(parser.errors().error.type) == "option",
+        "one missing required option");
+
+  ostringstream usage;
+  usage << parser.usage();
+  check(usage.str().find("--host <host> -u <user> [-v]") != string::npos,
+        "required options lose their brackets in usage");
+}
+
+// ---------------
+// Compressed Help
+// ---------------
+static void test_help_blob() {
+  vector<string> entries = {
+      "Number of worker threads to start",
+      "",
+      "Number of worker threads to keep idle",
+      string(300, 'a'),  // A match overlapping the text it copies
+      "Bytes \xff\x80 outside ASCII, and a long repeat: " + string(40, '-') +
+          string(40, '-')};
+  string blob = compress_help(entries);
+  auto data = reinterpret_cast<const unsigned char*>(blob.data());
+  check(expand_help(data, blob.size()) == entries,
+        "help entries survive compression");
+  check(blob.size() < 300, "repeated help text compresses");
+
+  BasicParser<ReturnErrors> parser;
+  parser.help_blob(data, blob.size());
+  parser.add_optargument<int>("idle", 'i').help_entry(2);
+  ostringstream help;
+  help << parser.help();
+  check(help.str().find(entries[2]) != string::npos,
+        "help shows an option's entry from the blob");
+}
+
+// -----------------
+// Option Namespaces
+// -----------------
+struct Pool {
+  int max_size = 1;
+  string name;
+};
+
+struct Database {
+  bool verbose = false;
+  Pool pool;
+};
+
+void cpparse_bind(Binder& binder, Pool& pool) {
+  binder.field("max-size", pool.max_size);
+  binder.field("name", pool.name);
+}
+
+void cpparse_bind(Binder& binder, Database& database) {
+  binder.field("verbose", database.verbose);
+  binder.group("pool", database.pool);
+}
+
+static void test_namespaces() {
+  BasicParser<ReturnErrors> parser;
+  Database database;
+  parser.bind("db", database);
+  check(parse(parser, {"--db.pool.max-size", "8", "--db.pool.name", "main",
+                       "--db.verbose", "true"}),
+        "bound struct fields parse");
+  check(database.pool.max_size == 8 && database.pool.name == "main" &&
+            database.verbose,
+        "bound fields are stored");
+  check(!parse(parser, {"--db.pool", "8"}), "a namespace isn't an option");
+  check(!parse(parser, {"--db.pool.max", "8"}) &&
+            !parse(parser, {"--db.pool.max-size.more", "8"}),
+        "only whole option names are found");
+}
+
+// ---------------
+// Memoizing Cache
+// ---------------
+static void test_memo_cache() {
+  auto twice = [](const string& input) { return 2 * read<int>(input); };
+  BasicParser<ReturnErrors> parser;
+  auto& plain = parser.add_optargument<int>("plain", 0).memoize(4);
+  auto& doubled = parser.add_optargument<int>("doubled", 0, twice).memoize(4);
+  check(parse(parser, {"--plain", "3", "--doubled", "3"}), "memoized options");
+  check(plain.get() == 3 && doubled.get() == 6,
+        "private caches keep their option's converter");
+
+  auto shared = make_shared<MemoCache<int>>(2, twice);
+  BasicParser<ReturnErrors> sharing;
+  auto& a = sharing.add_optargument<int>("a", 0).memoize(shared);
+  auto& b = sharing.add_optargument<int>("b", 0).memoize(shared);
+  check(parse(sharing, {"--a", "1", "--b", "1"}), "shared cache");
+  check(a.get() == 2 && b.get() == 2, "a shared cache converts with its own");
+
+  // Least recently used entries are evicted first
+  int calls = 0;
+  MemoCache<int> counted(2, [&calls](const string& input) {
+    calls++;
+    return read<int>(input);
+  });
+  for (auto token : {"1", "2", "1", "3", "1", "2"}) {
+    counted.convert(token);
+  }
+  check(calls == 4, "LRU eviction keeps the recently used entries");
+}
+
+// -----------------
+// Reloadable Values
+// -----------------
+// Counts live copies so tests can see when superseded values are freed
+struct Tracked {
+  static int live;
+  int value;
+  explicit Tracked(int value_) : value(value_) { live++; }
+  Tracked(const Tracked& other) : value(other.value) { live++; }
+  ~Tracked() { live--; }
+};
+int Tracked::live = 0;
+
+static void test_reloadable_snapshots() {
+  auto convert = [](const string& input) { return Tracked(read<int>(input)); };
+  {
+    BasicParser<ReturnErrors> parser;
+    auto& value =
+        parser.add_reloadable<Tracked>("value", 0, Tracked(0), convert);
+    for (auto token : {"1", "2", "3"}) {
+      value.set(token);
+    }
+    check(Tracked::live == 1 && value.get().value == 3,
+          "superseded values nobody holds are freed");
+
+    auto held = value.snapshot();
+    value.set("4");
+    check(Tracked::live == 2 && held->value == 3 && value.get().value == 4,
+          "a snapshot keeps its value alive through updates");
+    held.reset();
+    check(Tracked::live == 1, "a value is freed with its last snapshot");
+
+    // Readers holding snapshots while another thread updates
+    thread writer([&value]() {
+      for (int i = 5; i < 1005; i++) {
+        value.set(to_string(i));
+      }
+    });
+    bool ordered = true;
+    int last = 0;
+    for (int i = 0; i < 1000; i++) {
+      auto current = value.snapshot();
+      ordered &= current->value >= last;
+      last = current->value;
+    }
+    writer.join();
+    check(ordered && value.get().value == 1004,
+          "snapshots see updates in order");
+  }
+  check(Tracked::live == 0, "reloadable values are freed with the parser");
+}
+
+#ifdef __linux__
+static void test_watcher() {
+  const string path = "test_watch.conf";
+  ofstream(path) << "level = 1\n";
+  BasicParser<ReturnErrors> parser;
+  auto& level = parser.add_reloadable<int>("level", 'l', 0);
+  {
+    Watcher watcher(parser, path);
+    ofstream(path) << "level = 2\n";
+    for (int i = 0; i < 200 && *level.snapshot() != 2; i++) {
+      this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    check(*level.snapshot() == 2, "a watcher reloads a written config");
+  }  // Joins the watcher thread before closing its descriptors
+  ofstream(path) << "level = 3\n";
+  this_thread::sleep_for(chrono::milliseconds(50));
+  check(level.get() == 2, "a destroyed watcher stops reloading");
+  remove(path.c_str());
+}
+#endif
+
+// -------
+// Plugins
+// -------
+static void test_plugin_adds_positional() {
+  ofstream("test_plugins.txt") << "./test_plugin.so plugged\n";
+  Parser parser;
+  parser.add_plugins("test_plugins.txt");
+  auto& first = parser.add_argument<int>("first");
+  check(parse(parser, {"1", "--plugged", "2"}), "plugin loaded mid parse");
+  void* plugin = dlopen("./test_plugin.so", RTLD_NOW | RTLD_NOLOAD);
+  auto second =
+      plugin ? reinterpret_cast<int (*)()>(dlsym(plugin, "plugin_second"))
+             : nullptr;
+  check(first.get() == 1 && second && second() == 2,
+        "a plugin can add positionals mid parse");
+  remove("test_plugins.txt");
+}
+
+// -----------------
+// Generated Parsers
+// -----------------
+static void test_generated_program_name() {
+  char program[] = "test", integer[] = "5";
+  char* argv[] = {program, integer, nullptr};
+  ExampleParser parser;
+  parser.parse(2, argv);
+  check(string(ExampleParser::usage()).find("usage: test [-b]") == 0,
+        "generated usage shows argv[0]");
+  check(string(ExampleParser::help()).find(ExampleParser::usage()) == 0,
+        "generated help starts with the same usage");
+}
+
+// Output and exit status of `program` run on `arguments`, named "test" so
+// that usage is the same whichever binary printed it
+static string run(const string& program, const string& arguments) {
+  string command =
+      "bash -c 'exec -a test ./" + program + " " + arguments + "' 2>&1";
+  FILE* pipe = popen(command.c_str(), "r");
+  if (!pipe) {
+    return "";
+  }
+  string output;
+  char buffer[256];
+  while (fgets(buffer, sizeof(buffer), pipe)) {
+    output += buffer;
+  }
+  return output + "status " + to_string(pclose(pipe)) + '\n';
+}
+
+static void test_generated_matches_runtime() {
+  for (string arguments :
+       {"5 1 2 -b 3", "5 -- -1 -b", "-d 2.5 5 1 --string 2", "5 1 x",
+        "x", "", "-z 5", "5 -d", "--extra-argument a 5 -b 1 2 3"}) {
+    check(run("gen_example", arguments) == run("example", arguments),
+          "gen_example and example agree on \"" + arguments + '"');
+  }
+}
+
+// -------------------------
+// Builds Without Exceptions
+// -------------------------
+static void test_noexcept() {
+  check(run("test_noexcept", "-l 3 -e 4") == "level 3 even 4\nstatus 0\n",
+        "a build without exceptions parses");
+  check(run("test_noexcept", "-e 3").find("Parse error trying to interpret "
+                                          "'even' argument \"3\"") == 0,
+        "a converter returning false is a parse error");
+  check(run("test_noexcept", "-t") ==
+            "handler: Can't add two options with the same name: \"level\"\n"
+            "status " + to_string(3 << 8) + '\n',
+        "setup mistakes go to the error handler");
+  for (string arguments : {"5 1 2 -b 3", "5 1 x", "x", "-d y 5", "-z 5"}) {
+    check(run("example_noexcept", arguments) == run("example", arguments),
+          "example_noexcept and example agree on \"" + arguments + '"');
+  }
+}
+
+// ---------
+// Benchmark
+// ---------
+// Whether `output` has a line reporting `workload`
+static bool reports(const string& output, const string& workload) {
+  istringstream lines(output);
+  string line;
+  while (getline(lines, line)) {
+    if (line.compare(0, workload.size() + 1, workload + ' ') == 0 &&
+        line.find(" ns/iter ") != string::npos &&
+        line.find(" ns/token") != string::npos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void test_bench() {
+  string output = run("bench", "10");
+  check(reports(output, "register") && reports(output, "parse") &&
+            reports(output, "help") && !reports(output, "replay") &&
+            output.find("status 0\n") != string::npos,
+        "bench times every workload");
+
+  const string path = "test_bench.corpus";
+  remove(path.c_str());
+  {
+    BasicParser<ReturnErrors> tool;
+    tool.add_optargument<int>("option-1", 0);
+    tool.add_argument<string>("input");
+    tool.capture(path);
+    parse(tool, {"--option-1", "5", "input.txt"});
+    parse(tool, {"--option-1", "x", "input.txt"});
+  }
+  output = run("bench", "10 " + path);
+  check(output.find("Replaying 2 command lines, 8 tokens: 1 accepted, "
+                    "1 rejected\n") != string::npos &&
+            reports(output, "replay"),
+        "bench replays a corpus");
+  remove(path.c_str());
+}
+
+int main() {
+#if defined(__GNUC__) && defined(__ELF__)
+  test_descriptors();
+#endif
+  test_capture_corpus();
+  test_variadic_after_option();
+  test_prescan();
+  test_parse_known();
+  test_repeated_expensive_option();
+  test_expensive_thread_bound();
+  test_async_error_thread();
+  test_stats();
+#ifndef CPPARSE_USDT
+  test_probes_compile_out();
+#endif
+  test_reused_parser_errors();
+  test_fixed_bool();
+  test_fixed_allocations();
+  test_pattern_repeats();
+  test_groups();
+  test_required();
+  test_help_blob();
+  test_namespaces();
+  test_memo_cache();
+  test_reloadable_snapshots();
+#ifdef __linux__
+  test_watcher();
+#endif
+  test_plugin_adds_positional();
+  test_generated_program_name();
+  test_generated_matches_runtime();
+  test_noexcept();
+  test_bench();
+
+  if (failures) {
+    cerr << failures << " check(s) failed\n";
+    return 1;
+  }
+  cout << "All tests passed\n";
+}